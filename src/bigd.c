@@ -52,9 +52,9 @@ It is an error to pass a NULL BIGD parameter except to bdFree.
 */
 
 #ifdef _DEBUG
-static int debug = 0; /* <= change this to > 0 for console debugging */
+static const int debug = 0; /* <= change this to > 0 for console debugging */
 #else
-static int debug = 0; /* <= ALWAYS ZERO */
+static const int debug = 0; /* <= ALWAYS ZERO */
 #endif
 
 /* Useful definitions */
@@ -118,6 +118,9 @@ Use carefully!
 2. If shrinking, it decreases ndigits and zeroises the excess.
 3. It does not increase b->ndigits; that's up to you later.
 4. It does not release excess digits; use bdFree.
+5. If b already has room it writes nothing: digits past ndigits are
+   always zero. So an input with room for the calculation is only read
+   and may be shared between threads, see bdReserve().
 
 In other words, it's like middle-aged spread: 
 you go from a 32" waist to a 38 but can never go backwards.
@@ -164,11 +167,9 @@ Better:
 		newp = (DIGIT_T *)malloc(newsize * sizeof(DIGIT_T));
 		oldp = b->digits;
 		
-		/* Check for failure */
+		/* Check for failure, leaving b intact for an mpFail() handler */
 		if (!newp)
 		{
-			mpSetZero(oldp, oldsize);
-			free(oldp);
 			mpFail("bd_resize: Failed to realloc memory.");
 		}
 
@@ -180,13 +181,19 @@ Better:
 		b->maxdigits = newsize;	/* Remember new allocated size */
 	}
 
-	/* Make sure new digits are zero */
+	/* Make sure new digits are zero (only writing those that aren't) */
 	for (i = b->ndigits; i < newsize; i++)
-		b->digits[i] = 0;
+		if (b->digits[i])
+			b->digits[i] = 0;
 
 	return 0;
 }
 
+int bdReserve(T b, size_t ndigits)
+{
+	return bd_resize(b, max(ndigits, b->ndigits));
+}
+
 /* New in [v2.6]: A more compact way to allocate and free BIGD variables */
 
 void bdNewVars(BIGD *pb1, ...)
@@ -1490,6 +1497,50 @@ int bdRandomSeeded(T a, size_t nbits, const unsigned char *seed,
 }
 
 
+/* Candidates are sieved by the odd primes below SIEVE_BOUND_MAX, or
+   64 * nbits if that is less, before any Rabin-Miller test. A window
+   of SIEVE_WINDOW odd numbers is sieved at a time. Below
+   SIEVE_MIN_BITS a candidate could be one of the sieving primes so the
+   plain mpIsPrime() loop is used. */
+#define SIEVE_BOUND_MAX 65536
+#define SIEVE_WINDOW 4096
+#define SIEVE_MIN_BITS 32
+
+static size_t sieve_primes(uint16_t primes[], unsigned char flags[], size_t bound)
+{	/*	Fills primes[] with the odd primes below bound using the sieve of
+		Eratosthenes over flags[bound/2]. Returns the count. */
+	size_t i, j, n;
+
+	memset(flags, 0, bound / 2);
+	n = 0;
+	for (i = 3; i < bound; i += 2)
+	{
+		if (flags[i / 2])
+			continue;
+		primes[n++] = (uint16_t)i;
+		for (j = i * i; j < bound; j += 2 * i)
+			flags[j / 2] = 1;
+	}
+	return n;
+}
+
+static void sieve_window(unsigned char composite[], const DIGIT_T p[], size_t ndigits,
+	const uint16_t primes[], size_t nprimes)
+{	/*	Sets composite[j] if p + 2j has a factor in primes[], p odd.
+		p + 2j = 0 (mod q) <=> j = (q - p mod q) * (q + 1)/2 (mod q) */
+	size_t i, j, q, r;
+
+	memset(composite, 0, SIEVE_WINDOW);
+	for (i = 0; i < nprimes; i++)
+	{
+		q = primes[i];
+		r = mpShortMod(p, (DIGIT_T)q, ndigits);
+		j = (((q - r) % q) * ((q + 1) / 2)) % q;
+		for (; j < SIEVE_WINDOW; j += q)
+			composite[j] = 1;
+	}
+}
+
 int bdGeneratePrime(T b, size_t nbits, size_t ntests, 
 	const unsigned char *seed, size_t seedlen, BD_RANDFUNC RandFunc)
 {
@@ -1498,6 +1549,9 @@ int bdGeneratePrime(T b, size_t nbits, size_t ntests,
 	DIGIT_T *p;
 	int done;
 	size_t iloop, maxloops, j, maxodd;
+	size_t bound, nprimes, w;
+	uint16_t *primes = NULL;
+	unsigned char *flags = NULL;
 
 	assert(b);
 	/* Make sure big enough */
@@ -1508,6 +1562,18 @@ int bdGeneratePrime(T b, size_t nbits, size_t ntests,
 	/* use a ptr */
 	p = b->digits;
 
+	/* Small primes to sieve with, see SIEVE_BOUND_MAX */
+	nprimes = 0;
+	if (nbits >= SIEVE_MIN_BITS)
+	{
+		bound = (nbits * 64 < SIEVE_BOUND_MAX ? nbits * 64 : SIEVE_BOUND_MAX);
+		flags = malloc(bound / 2 > SIEVE_WINDOW ? bound / 2 : SIEVE_WINDOW);
+		primes = malloc(bound / 2 * sizeof(uint16_t));
+		if (!flags || !primes)
+			mpFail("bdGeneratePrime: Unable to allocate memory.");
+		nprimes = sieve_primes(primes, flags, bound);
+	}
+
 	maxloops = 5;
 	maxodd = 100 * nbits;
 	done = 0;
@@ -1516,25 +1582,43 @@ int bdGeneratePrime(T b, size_t nbits, size_t ntests,
 		/* Generate random digits using callback function */
 		RandFunc((unsigned char *)p, nbytes, seed, seedlen);
 
-		/* Set high and low bits */
+		/* Set the top two bits and the low bit. With the top two set the
+		   product of two such primes has exactly 2 * nbits bits. */
 		hibit = (nbits-1) % BITS_PER_DIGIT;
-		mask = 0x01 << hibit;
+		mask = (DIGIT_T)0x01 << hibit;
 		for (chop = 0x01, i = 0; i < hibit; i++)
 			chop = (chop << 1) | chop;
 
 		p[ndigits-1] |= mask;
 		p[ndigits-1] &= chop;
+		if (nbits >= 2)
+			mpSetBit(p, ndigits, nbits-2, 1);
 		p[0] |= 0x01;
 
 		/* Try each odd number until success or too many tries */
-		for (j = 0; !done && j < maxodd; j++, mpShortAdd(p, p, 2, ndigits))
+		for (j = 0, w = SIEVE_WINDOW; !done && j < maxodd; j++, w++, mpShortAdd(p, p, 2, ndigits))
 		{
 			if (!(p[ndigits-1] & mask))
 				break;	/* Catch overflow */
 
 			if (debug) mpPrintNL(p, ndigits);
 
-			if (mpIsPrime(p, ndigits, ntests))
+			if (nprimes == 0)
+			{
+				if (mpIsPrime(p, ndigits, ntests))
+				{
+					done = 1;
+					break;
+				}
+				continue;
+			}
+
+			if (w == SIEVE_WINDOW)
+			{
+				sieve_window(flags, p, ndigits, primes, nprimes);
+				w = 0;
+			}
+			if (!flags[w] && mpRabinMiller(p, ndigits, ntests))
 			{
 				done = 1;
 				break;
@@ -1544,6 +1628,9 @@ int bdGeneratePrime(T b, size_t nbits, size_t ntests,
 
 	if (debug) mpPrintNL(p, ndigits);
 
+	free(primes);
+	free(flags);
+
 	b->ndigits = ndigits;
 
 	return (done ? 0 : 1);
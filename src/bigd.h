@@ -81,7 +81,11 @@ The standard code for a variable `b` should be as follows:
 */
 
 /** A synonym for a single digit (DIGIT_T is not exposed) */
+#ifdef USE_DIGIT64
+typedef uint64_t bdigit_t;
+#else
 typedef uint32_t bdigit_t;
+#endif
 
 /**** END OF USER CONFIGURABLE SECTION ****/
 /** @cond */
@@ -493,6 +497,12 @@ void bdNotBits(BIGD a, BIGD b);
 /* MISC OPERATIONS */
 /*******************/
 
+/** Makes room for at least `ndigits` digits in b without changing its value
+ *  @remark A BIGD with room for every calculation it is an input to is only read
+ *  by them, so it may be shared between threads.
+ */
+int bdReserve(BIGD b, size_t ndigits);
+
 /** Returns number of significant digits in b */
 size_t bdSizeof(BIGD b);
 
@@ -635,7 +645,11 @@ int bdRandomSeeded(BIGD a, size_t nbits, const unsigned char *seed,
  *  @param [in] ntests Number of primality tests to carry out (recommended at least 80)
  *  @param [in] seed Optional seed to add extra entropy
  *  @param [in] seedlen Number of bytes in seed
- *  @param [in] RandFunc User function to generate random bytes */
+ *  @param [in] RandFunc User function to generate random bytes
+ *  @returns 0 on success, 1 if no prime was found
+ *  @remark The top two bits are set, so the product of two `nbits`-bit 
+ *  primes has exactly `2*nbits` bits. Candidates are trial divided by a 
+ *  sieve over a window of odd numbers before any Rabin-Miller test. */
 int bdGeneratePrime(BIGD a, size_t nbits, size_t ntests, const unsigned char *seed, 
 	size_t seedlen, BD_RANDFUNC RandFunc);
 
@@ -65,10 +65,49 @@ static const int kUseNoAllocs = 0;
 #define HIHALF(x) ((DIGIT_T)((x) >> BITS_PER_HALF_DIGIT & MAX_HALF_DIGIT))
 #define TOHIGH(x) ((DIGIT_T)((x) << BITS_PER_HALF_DIGIT))
 #define mpNEXTBITMASK(mask, n) do{if(mask==1){mask=HIBITMASK;n--;}else{mask>>=1;}}while(0)
+#define mpGETBIT(a, i) (((a)[(i) / BITS_PER_DIGIT] >> ((i) % BITS_PER_DIGIT)) & 0x1)
+
+/* Double-width type for the multiply-accumulate kernels */
+#ifdef USE_DIGIT64
+#ifndef __SIZEOF_INT128__
+#error "USE_DIGIT64 requires unsigned __int128"
+#endif
+typedef unsigned __int128 DIGIT2_T;
+#else
+typedef uint64_t DIGIT2_T;
+#endif
 
 /****************************/
 /* ERROR HANDLING FUNCTIONS */
 /****************************/
+/* Per-thread handler replacing the exit in mpFail(), see mpSetFailHandler() */
+static MP_THREAD_LOCAL MP_FAILFUNC fail_func;
+static MP_THREAD_LOCAL void *fail_arg;
+static MP_THREAD_LOCAL size_t fail_scratch_used;
+static MP_THREAD_LOCAL int fail_scratch_depth;
+static void scratch_state(size_t *used, int *depth);
+static void scratch_unwind(size_t used, int depth);
+
+void mpSetFailHandler(MP_FAILFUNC fn, void *arg)
+{
+	fail_func = fn;
+	fail_arg = arg;
+	scratch_state(&fail_scratch_used, &fail_scratch_depth);
+}
+
+static void fail_dispatch(char *msg)
+{	/*	Hands msg to the calling thread's handler, if any, after closing
+		the scratch scopes opened since it was installed. The handler is
+		removed first so a failure inside it falls through to the exit. */
+	MP_FAILFUNC fn = fail_func;
+
+	if (!fn)
+		return;
+	fail_func = NULL;
+	scratch_unwind(fail_scratch_used, fail_scratch_depth);
+	fn(msg, fail_arg);
+}
+
 /* Change these to suit your tastes and operating system. */
 #if defined(_WIN32) || defined(WIN32)
 /* Win32 GUI alternative */
@@ -79,12 +118,14 @@ static const int kUseNoAllocs = 0;
 #include <windows.h>
 void mpFail(char *msg)
 {
+	fail_dispatch(msg);
 	MessageBox(NULL, msg, "BigDigits Error", MB_ICONERROR);
 	exit(EXIT_FAILURE);
 }
 #else	/* Ordinary console program */
 void mpFail(char *msg)
 {
+	fail_dispatch(msg);
 	perror(msg);
 	exit(EXIT_FAILURE);
 }
@@ -94,6 +135,26 @@ void mpFail(char *msg)
 /* MEMORY ALLOCATION FUNCTIONS */
 /*******************************/
 #ifndef NO_ALLOCS
+/* Per-thread scratch arena used by mpAlloc while a scope is open */
+static MP_THREAD_LOCAL DIGIT_T *scratch_buf;
+static MP_THREAD_LOCAL size_t scratch_cap;	/* in digits */
+static MP_THREAD_LOCAL size_t scratch_used;
+static MP_THREAD_LOCAL size_t scratch_need;	/* peak demand incl. overflow */
+static MP_THREAD_LOCAL size_t scratch_over;	/* demand that went to the heap */
+static MP_THREAD_LOCAL int scratch_depth;
+
+/* Per-thread Barrett reciprocal for the last modulus seen by mpModMult
+   and mpModSquare, see mpBarrettCached() */
+static MP_THREAD_LOCAL DIGIT_T *barrett_m;
+static MP_THREAD_LOCAL DIGIT_T *barrett_mu;
+static MP_THREAD_LOCAL size_t barrett_ndigits;
+static MP_THREAD_LOCAL int barrett_ready;
+
+static int scratch_owns(const DIGIT_T *p)
+{
+	return (scratch_buf && p >= scratch_buf && p < scratch_buf + scratch_cap);
+}
+
 DIGIT_T *mpAlloc(size_t ndigits)
 {
 	DIGIT_T *ptr;
@@ -101,6 +162,19 @@ DIGIT_T *mpAlloc(size_t ndigits)
 	/* [v2.3] added check for zero digits. Thanks to "Radistao" */
 	if (ndigits < 1) ndigits = 1;
 
+	if (scratch_depth > 0)
+	{
+		if (scratch_used + ndigits + scratch_over > scratch_need)
+			scratch_need = scratch_used + ndigits + scratch_over;
+		if (scratch_cap - scratch_used >= ndigits)
+		{	/* Space beyond scratch_used is always zero */
+			ptr = scratch_buf + scratch_used;
+			scratch_used += ndigits;
+			return ptr;
+		}
+		scratch_over += ndigits;
+	}
+
 	ptr = (DIGIT_T *)calloc(ndigits, sizeof(DIGIT_T));
 	if (!ptr)
 		mpFail("mpAlloc: Unable to allocate memory.");
@@ -112,10 +186,93 @@ void mpFree(DIGIT_T **p)
 {
 	if (*p)
 	{
-		free(*p);
+		if (!scratch_owns(*p))
+			free(*p);
 		*p = NULL;
 	}
 }
+
+size_t mpScratchBegin(void)
+{
+	if (scratch_depth == 0 && scratch_need > scratch_cap)
+	{	/* Warm-up: grow to the peak seen so far */
+		DIGIT_T *p = (DIGIT_T *)calloc(scratch_need, sizeof(DIGIT_T));
+		if (!p)
+			mpFail("mpScratchBegin: Unable to allocate memory.");
+		free(scratch_buf);
+		scratch_buf = p;
+		scratch_cap = scratch_need;
+	}
+	if (scratch_depth == 0)
+		scratch_over = 0;
+	scratch_depth++;
+	return scratch_used;
+}
+
+void mpScratchEnd(size_t mark)
+{
+	assert(scratch_depth > 0 && mark <= scratch_used);
+	if (scratch_used > mark)
+		mpSetZero(scratch_buf + mark, scratch_used - mark);
+	scratch_used = mark;
+	scratch_depth--;
+}
+
+static void scratch_state(size_t *used, int *depth)
+{
+	*used = scratch_used;
+	*depth = scratch_depth;
+}
+
+static void scratch_unwind(size_t used, int depth)
+{	/*	Abandons the scopes opened above depth, zeroising their space.
+		Heap temporaries from them are not tracked and are leaked. */
+	if (scratch_depth <= depth)
+		return;
+	if (scratch_used > used)
+		mpSetZero(scratch_buf + used, scratch_used - used);
+	scratch_used = used;
+	scratch_depth = depth;
+}
+
+void mpScratchRelease(void)
+{
+	assert(scratch_depth == 0);
+	free(scratch_buf);
+	scratch_buf = NULL;
+	scratch_cap = scratch_used = scratch_need = scratch_over = 0;
+	free(barrett_m);
+	free(barrett_mu);
+	barrett_m = barrett_mu = NULL;
+	barrett_ndigits = 0;
+	barrett_ready = 0;
+}
+#else
+size_t mpScratchBegin(void)
+{
+	return 0;
+}
+
+void mpScratchEnd(size_t mark)
+{
+	(void)mark;
+}
+
+static void scratch_state(size_t *used, int *depth)
+{
+	*used = 0;
+	*depth = 0;
+}
+
+static void scratch_unwind(size_t used, int depth)
+{
+	(void)used;
+	(void)depth;
+}
+
+void mpScratchRelease(void)
+{
+}
 #endif /* NO_ALLOCS */
 
 /* Added in [v2.4] for ALLOC_BYTES and FREE_BYTES */
@@ -183,7 +340,29 @@ OPTIONS:
 3. use default "long" calculations (any platform)
 */
 
-#ifdef USE_64WITH32
+#ifdef USE_DIGIT64
+/* 0. 64-bit digits with a 128-bit type for the double-width results */
+
+int spMultiply(DIGIT_T p[2], DIGIT_T x, DIGIT_T y)
+{
+	DIGIT2_T t = (DIGIT2_T)x * y;
+	p[1] = (DIGIT_T)(t >> BITS_PER_DIGIT);
+	p[0] = (DIGIT_T)t;
+
+	return 0;
+}
+
+DIGIT_T spDivide(DIGIT_T *pq, DIGIT_T *pr, const DIGIT_T u[2], DIGIT_T v)
+{
+	DIGIT2_T uu, q;
+	uu = (DIGIT2_T)u[1] << BITS_PER_DIGIT | u[0];
+	q = uu / v;
+	*pr = (DIGIT_T)(uu - q * v);
+	*pq = (DIGIT_T)q;
+	return (DIGIT_T)(q >> BITS_PER_DIGIT);
+}
+
+#elif defined(USE_64WITH32)
 /* 1. We are on a 32-bit machine with a 64-bit type available. */
 #pragma message("USE_64WITH32 is set")
 
@@ -587,57 +766,52 @@ DIGIT_T mpSubtract(DIGIT_T w[], const DIGIT_T u[], const DIGIT_T v[], size_t ndi
 	return k;	/* Should be zero if u >= v */
 }
 
-int mpMultiply(DIGIT_T w[], const DIGIT_T u[], const DIGIT_T v[], size_t ndigits)
-{
-	/*	Computes product w = u * v
+/* Comba product scanning: each column sum_{i+j=k} u_i * v_j is gathered
+   in a double digit accumulator t plus an overflow digit c held in
+   locals, and only the finished low digit is stored. Ref: P. G. Comba,
+   "Exponentiation cryptosystems on the IBM PC", IBM Systems Journal
+   29(4), 1990. */
+
+/* (c,t) += x * y */
+#define mpCOMBA_MULADD(t, c, x, y) do { \
+	DIGIT2_T p_ = (DIGIT2_T)(x) * (y); \
+	(t) += p_; \
+	(c) += ((t) < p_); \
+} while (0)
+
+/* Store the low digit of column k and shift (c,t) down one digit */
+#define mpCOMBA_STORE(w, k, t, c) do { \
+	(w)[k] = (DIGIT_T)(t); \
+	(t) = ((t) >> BITS_PER_DIGIT) | ((DIGIT2_T)(c) << BITS_PER_DIGIT); \
+	(c) = 0; \
+} while (0)
+
+static int mpMultiply_comba(DIGIT_T w[], const DIGIT_T u[], const DIGIT_T v[], size_t ndigits)
+{	/*	Computes product w = u * v
 		where u, v are multiprecision integers of ndigits each
 		and w is a multiprecision integer of 2*ndigits
-
-		Ref: Knuth Vol 2 Ch 4.3.1 p 268 Algorithm M.
 	*/
-
-	DIGIT_T k, t[2];
-	size_t i, j, m, n;
+	DIGIT2_T t;
+	DIGIT_T c;
+	size_t i, k, lo, hi;
 
 	assert(w != u && w != v);
 
-	m = n = ndigits;
-
-	/* Step M1. Initialise */
-	for (i = 0; i < 2 * m; i++)
-		w[i] = 0;
+	if (ndigits == 0)
+		return 0;
 
-	for (j = 0; j < n; j++)
+	t = 0;
+	c = 0;
+	for (k = 0; k < 2 * ndigits - 1; k++)
 	{
-		/* Step M2. Zero multiplier? */
-		if (v[j] == 0)
-		{
-			w[j + m] = 0;
-		}
-		else
-		{
-			/* Step M3. Initialise i */
-			k = 0;
-			for (i = 0; i < m; i++)
-			{
-				/* Step M4. Multiply and add */
-				/* t = u_i * v_j + w_(i+j) + k */
-				spMultiply(t, u[i], v[j]);
-
-				t[0] += k;
-				if (t[0] < k)
-					t[1]++;
-				t[0] += w[i+j];
-				if (t[0] < w[i+j])
-					t[1]++;
-
-				w[i+j] = t[0];
-				k = t[1];
-			}	
-			/* Step M5. Loop on i, set w_(j+m) = k */
-			w[j+m] = k;
-		}
-	}	/* Step M6. Loop on j */
+		lo = (k < ndigits ? 0 : k - ndigits + 1);
+		hi = (k < ndigits ? k : ndigits - 1);
+		for (i = lo; i <= hi; i++)
+			mpCOMBA_MULADD(t, c, u[i], v[k - i]);
+
+		mpCOMBA_STORE(w, k, t, c);
+	}
+	w[2 * ndigits - 1] = (DIGIT_T)t;
 
 	return 0;
 }
@@ -710,7 +884,8 @@ int mpDivide(DIGIT_T q[], DIGIT_T r[], const DIGIT_T u[],
 
 		WARNING: this trashes q and r first, so cannot do
 		u = u / v or v = u mod v.
-		It also changes v temporarily so cannot make it const.
+		v is normalised into a copy and never written, so several
+		threads may divide by the same v at once.
 	*/
 	size_t shift;
 	int n, m, j;
@@ -718,6 +893,11 @@ int mpDivide(DIGIT_T q[], DIGIT_T r[], const DIGIT_T u[],
 	DIGIT_T qhat, rhat, t[2];
 	DIGIT_T *uu, *ww;
 	int qhatOK, cmp;
+#ifdef NO_ALLOCS
+	DIGIT_T vv[MAX_FIXED_DIGITS * 2];
+#else
+	DIGIT_T *vv;
+#endif
 
 	/* Clear q and r */
 	mpSetZero(q, udigits);
@@ -781,8 +961,14 @@ int mpDivide(DIGIT_T q[], DIGIT_T r[], const DIGIT_T u[],
 		bitmask >>= 1;
 	}
 
-	/* Normalise v in situ - NB only shift non-zero digits */
-	overflow = mpShiftLeft(v, v, shift, n);
+	/* Normalise a copy of v - NB only shift non-zero digits */
+#ifdef NO_ALLOCS
+	assert((size_t)n <= MAX_FIXED_DIGITS * 2);
+#else
+	vv = mpAlloc(n);
+#endif
+	overflow = mpShiftLeft(vv, v, shift, n);
+	v = vv;	/* From here on v is the normalised copy */
 
 	/* Copy normalised dividend u*d into r */
 	overflow = mpShiftLeft(r, u, shift, n + m);
@@ -846,121 +1032,243 @@ int mpDivide(DIGIT_T q[], DIGIT_T r[], const DIGIT_T u[],
 	/* Step D8. Unnormalise. */
 
 	mpShiftRight(r, r, shift, n);
-	mpShiftRight(v, v, shift, n);
+	mpDESTROY(vv, n);
 
 	return 0;
 }
 
 
-int mpSquare(DIGIT_T w[], const DIGIT_T x[], size_t ndigits)
-/* New in Version 2.0 */
-{
-	/*	Computes square w = x * x
+static int mpSquare_comba(DIGIT_T w[], const DIGIT_T x[], size_t ndigits)
+{	/*	Computes square w = x * x
 		where x is a multiprecision integer of ndigits
 		and w is a multiprecision integer of 2*ndigits
 
-		Ref: Menezes p596 Algorithm 14.16 with errata.
+		Comba columns as mpMultiply_comba, but each column's cross
+		products x_i * x_j (i < j) are summed once into (dc,d) and
+		doubled before the square term is added: about half the
+		digit multiplications.
 	*/
-
-	DIGIT_T k, p[2], u[2], cbit, carry;
-	size_t i, j, t, i2, cpos;
+	DIGIT2_T t, d;
+	DIGIT_T c, dc;
+	size_t i, k, lo, hi;
 
 	assert(w != x);
 
-	t = ndigits;
-
-	/* 1. For i from 0 to (2t-1) do: w_i = 0 */
-	i2 = t << 1;
-	for (i = 0; i < i2; i++)
-		w[i] = 0;
+	if (ndigits == 0)
+		return 0;
 
-	carry = 0;
-	cpos = i2-1;
-	/* 2. For i from 0 to (t-1) do: */
-	for (i = 0; i < t; i++)
+	t = 0;
+	c = 0;
+	for (k = 0; k < 2 * ndigits - 1; k++)
 	{
-		/* 2.1 (uv) = w_2i + x_i * x_i, w_2i = v, c = u 
-		   Careful, w_2i may be double-prec
-		*/
-		i2 = i << 1; /* 2*i */
-		spMultiply(p, x[i], x[i]);
-		p[0] += w[i2];
-		if (p[0] < w[i2])
-			p[1]++;
-		k = 0;	/* p[1] < b, so no overflow here */
-		if (i2 == cpos && carry)
-		{
-			p[1] += carry;
-			if (p[1] < carry)
-				k++;
-			carry = 0;
-		}
-		w[i2] = p[0];
-		u[0] = p[1];
-		u[1] = k;
-
-		/* 2.2 for j from (i+1) to (t-1) do:
-		   (uv) = w_{i+j} + 2x_j * x_i + c,
-		   w_{i+j} = v, c = u,
-		   u is double-prec 
-		   w_{i+j} is dbl if [i+j] == cpos
-		*/
-		k = 0;
-		for (j = i+1; j < t; j++)
-		{
-			/* p = x_j * x_i */
-			spMultiply(p, x[j], x[i]);
-			/* p = 2p <=> p <<= 1 */
-			cbit = (p[0] & HIBITMASK) != 0;
-			k =  (p[1] & HIBITMASK) != 0;
-			p[0] <<= 1;
-			p[1] <<= 1;
-			p[1] |= cbit;
-			/* p = p + c */
-			p[0] += u[0];
-			if (p[0] < u[0])
-			{
-				p[1]++;
-				if (p[1] == 0)
-					k++;
-			}
-			p[1] += u[1];
-			if (p[1] < u[1])
-				k++;
-			/* p = p + w_{i+j} */
-			p[0] += w[i+j];
-			if (p[0] < w[i+j])
-			{
-				p[1]++;
-				if (p[1] == 0)
-					k++;
-			}
-			if ((i+j) == cpos && carry)
-			{	/* catch overflow from last round */
-				p[1] += carry;
-				if (p[1] < carry)
-					k++;
-				carry = 0;
-			}
-			/* w_{i+j} = v, c = u */
-			w[i+j] = p[0];
-			u[0] = p[1];
-			u[1] = k;
-		}
-		/* 2.3 w_{i+t} = u */
-		w[i+t] = u[0];
-		/* remember overflow in w_{i+t} */
-		carry = u[1];	
-		cpos = i+t;
+		lo = (k < ndigits ? 0 : k - ndigits + 1);
+		hi = (k < ndigits ? k : ndigits - 1);
+
+		d = 0;
+		dc = 0;
+		for (i = lo; i < k - i && i <= hi; i++)
+			mpCOMBA_MULADD(d, dc, x[i], x[k - i]);
+
+		/* (c,t) += 2 * (dc,d) */
+		dc = (dc << 1) | (DIGIT_T)(d >> (2 * BITS_PER_DIGIT - 1));
+		d <<= 1;
+		t += d;
+		c += dc + (t < d);
+
+		if ((k & 1) == 0)
+			mpCOMBA_MULADD(t, c, x[k / 2], x[k / 2]);
+
+		mpCOMBA_STORE(w, k, t, c);
 	}
+	w[2 * ndigits - 1] = (DIGIT_T)t;
+
+	return 0;
+}
+
+/* Operands of at least this many digits are multiplied by splitting
+   them in half (Karatsuba), which replaces one of the four half-size
+   products with a few additions. Squares switch later as the Comba
+   square already skips half its products. Tuned on x86-64 for both
+   digit sizes; override with -DKARATSUBA_THRESHOLD=n and
+   -DKARATSUBA_SQR_THRESHOLD=n */
+#ifndef KARATSUBA_THRESHOLD
+#define KARATSUBA_THRESHOLD 48
+#endif
+#ifndef KARATSUBA_SQR_THRESHOLD
+#define KARATSUBA_SQR_THRESHOLD 96
+#endif
+
+#ifndef NO_ALLOCS
+static size_t mpKaratsubaTemp(size_t ndigits, size_t threshold)
+{	/*	Returns the temp length the Karatsuba routines need for ndigits */
+	size_t m;
+
+	if (ndigits < threshold)
+		return 0;
+	m = (ndigits + 1) / 2;
+	return 4 * m + max(mpKaratsubaTemp(m, threshold), 2 * m + 1);
+}
 
-	/* (NB original step 3 deleted in Menezes errata) */
+static DIGIT_T mpAddInto(DIGIT_T w[], size_t wdigits, const DIGIT_T v[], size_t vdigits)
+{	/*	Computes w += v where vdigits <= wdigits. Returns carry. */
+	DIGIT_T k;
+	size_t j;
+
+	k = mpAdd(w, w, v, vdigits);
+	for (j = vdigits; k && j < wdigits; j++)
+		k = (++w[j] == 0);
+
+	return k;
+}
 
-	/* Return w */
+static DIGIT_T mpSubFrom(DIGIT_T w[], size_t wdigits, const DIGIT_T v[], size_t vdigits)
+{	/*	Computes w -= v where vdigits <= wdigits. Returns borrow. */
+	DIGIT_T k;
+	size_t j;
+
+	k = mpSubtract(w, w, v, vdigits);
+	for (j = vdigits; k && j < wdigits; j++)
+		k = (w[j]-- == 0);
+
+	return k;
+}
+
+static int mpAbsDiffHalves(DIGIT_T d[], const DIGIT_T a[], const DIGIT_T b[], size_t m, size_t h)
+{	/*	Computes d = |a - b| where a has m digits and b has h <= m.
+		Returns 1 if b > a, else 0. */
+	mpSetZero(d, m);
+	mpSetEqual(d, b, h);
+	if (mpCompare(d, a, m) > 0)
+	{
+		mpSubFrom(d, m, a, m);
+		return 1;
+	}
+	mpSetEqual(d, a, m);
+	mpSubFrom(d, m, b, h);
 
 	return 0;
 }
 
+static void mpKaratsubaMiddle(DIGIT_T w[], const DIGIT_T p[], int neg, 
+	size_t m, size_t h, DIGIT_T s[])
+{	/*	Given w = z2 * B^2 + z0 with z0 of 2m digits and z2 of 2h digits,
+		adds (z0 + z2 - p) * B to w, or (z0 + z2 + p) * B if neg,
+		where B = 2^(m * BITS_PER_DIGIT). Uses temp s[2m+1]. */
+	mpSetEqual(s, w, 2 * m);
+	s[2 * m] = 0;
+	mpAddInto(s, 2 * m + 1, &w[2 * m], 2 * h);
+	if (neg)
+		mpAddInto(s, 2 * m + 1, p, 2 * m);
+	else
+		mpSubFrom(s, 2 * m + 1, p, 2 * m);
+	mpAddInto(&w[m], m + 2 * h, s, 2 * m + 1);
+}
+
+static void mpKaratsuba_t(DIGIT_T w[], const DIGIT_T u[], const DIGIT_T v[], 
+	size_t ndigits, DIGIT_T t[])
+{	/*	Computes w = u * v using temp t[mpKaratsubaTemp(ndigits, KARATSUBA_THRESHOLD)].
+		Splitting u = u1 * B + u0 and v = v1 * B + v0 at m digits:
+		u * v = z2 * B^2 + (z0 + z2 - (u0 - u1)(v0 - v1)) * B + z0
+		where z0 = u0 * v0 and z2 = u1 * v1. */
+	size_t m, h;
+	int neg;
+	DIGIT_T *du, *dv, *p, *s;
+
+	if (ndigits < KARATSUBA_THRESHOLD)
+	{
+		mpMultiply_comba(w, u, v, ndigits);
+		return;
+	}
+
+	m = (ndigits + 1) / 2;
+	h = ndigits - m;
+	du = t;
+	dv = t + m;
+	p = t + 2 * m;
+	s = t + 4 * m;
+
+	mpKaratsuba_t(w, u, v, m, s);
+	mpKaratsuba_t(&w[2 * m], &u[m], &v[m], h, s);
+	neg = mpAbsDiffHalves(du, u, &u[m], m, h);
+	neg ^= mpAbsDiffHalves(dv, v, &v[m], m, h);
+	mpKaratsuba_t(p, du, dv, m, s);
+
+	mpKaratsubaMiddle(w, p, neg, m, h, s);
+}
+
+static void mpKaratsubaSquare_t(DIGIT_T w[], const DIGIT_T x[], 
+	size_t ndigits, DIGIT_T t[])
+{	/*	Computes w = x^2 using temp
+		t[mpKaratsubaTemp(ndigits, KARATSUBA_SQR_THRESHOLD)].
+		As mpKaratsuba_t with u = v so the middle product is a square. */
+	size_t m, h;
+	DIGIT_T *d, *p, *s;
+
+	if (ndigits < KARATSUBA_SQR_THRESHOLD)
+	{
+		mpSquare_comba(w, x, ndigits);
+		return;
+	}
+
+	m = (ndigits + 1) / 2;
+	h = ndigits - m;
+	d = t;
+	p = t + 2 * m;
+	s = t + 4 * m;
+
+	mpKaratsubaSquare_t(w, x, m, s);
+	mpKaratsubaSquare_t(&w[2 * m], &x[m], h, s);
+	mpAbsDiffHalves(d, x, &x[m], m, h);
+	mpKaratsubaSquare_t(p, d, m, s);
+
+	mpKaratsubaMiddle(w, p, 0, m, h, s);
+}
+#endif /* NO_ALLOCS */
+
+int mpMultiply(DIGIT_T w[], const DIGIT_T u[], const DIGIT_T v[], size_t ndigits)
+{	/*	Computes product w = u * v
+		where u, v are multiprecision integers of ndigits each
+		and w is a multiprecision integer of 2*ndigits */
+#ifndef NO_ALLOCS
+	DIGIT_T *t;
+	size_t nt;
+
+	if (ndigits >= KARATSUBA_THRESHOLD)
+	{
+		assert(w != u && w != v);
+		nt = mpKaratsubaTemp(ndigits, KARATSUBA_THRESHOLD);
+		t = mpAlloc(nt);
+		mpKaratsuba_t(w, u, v, ndigits, t);
+		mpDESTROY(t, nt);
+		return 0;
+	}
+#endif
+
+	return mpMultiply_comba(w, u, v, ndigits);
+}
+
+int mpSquare(DIGIT_T w[], const DIGIT_T x[], size_t ndigits)
+{	/*	Computes square w = x * x
+		where x is a multiprecision integer of ndigits
+		and w is a multiprecision integer of 2*ndigits */
+#ifndef NO_ALLOCS
+	DIGIT_T *t;
+	size_t nt;
+
+	if (ndigits >= KARATSUBA_SQR_THRESHOLD)
+	{
+		assert(w != x);
+		nt = mpKaratsubaTemp(ndigits, KARATSUBA_SQR_THRESHOLD);
+		t = mpAlloc(nt);
+		mpKaratsubaSquare_t(w, x, ndigits, t);
+		mpDESTROY(t, nt);
+		return 0;
+	}
+#endif
+
+	return mpSquare_comba(w, x, ndigits);
+}
+
 /** Returns true if a == b, else false. Not constant-time. */
 int mpEqual(const DIGIT_T a[], const DIGIT_T b[], size_t ndigits)
 {
@@ -2045,6 +2353,138 @@ int mpModulo(DIGIT_T r[], const DIGIT_T u[], size_t udigits,
 	return 0;
 }
 
+/* BARRETT REDUCTION */
+/* Ref: Menezes p604 Algorithm 14.42. With k = mpSizeof(m) and
+   B = 2^BITS_PER_DIGIT, mu = floor(B^(2k) / m) gives an estimate of
+   floor(x / m) at most 2 too small for any x < B^(2k), so x mod m costs
+   two multiplications instead of a long division. */
+
+int mpBarrettInit(DIGIT_T mu[], DIGIT_T m[], size_t ndigits)
+{	/*	Computes mu = floor(B^(2k) / m) into mu[ndigits+2] */
+	size_t k = mpSizeof(m, ndigits);
+	size_t nu = 2 * k + 1;
+#ifdef NO_ALLOCS
+	DIGIT_T u[MAX_FIXED_DIGITS * 2 + 1];
+	DIGIT_T q[MAX_FIXED_DIGITS * 2 + 1];
+	DIGIT_T r[MAX_FIXED_DIGITS * 2 + 1];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *u, *q, *r;
+	u = mpAlloc(nu);
+	q = mpAlloc(nu);
+	r = mpAlloc(nu);
+#endif
+
+	assert(k > 0);
+
+	mpSetZero(u, nu);
+	u[2 * k] = 1;
+	mpDivide(q, r, u, nu, m, k);
+
+	/* mu <= B^(k+1) so fits in k+2 digits */
+	mpSetZero(mu, ndigits + 2);
+	mpSetEqual(mu, q, k + 2);
+
+	mpDESTROY(u, nu);
+	mpDESTROY(q, nu);
+	mpDESTROY(r, nu);
+
+	return 0;
+}
+
+int mpBarrettReduce(DIGIT_T r[], const DIGIT_T x[], const DIGIT_T m[], 
+	const DIGIT_T mu[], size_t ndigits)
+{	/*	Computes r = x mod m for x[2*ndigits] < B^(2k) using mu from
+		mpBarrettInit(). r is ndigits long and may overlap x. */
+	size_t k = mpSizeof(m, ndigits);
+	size_t kk = k + 2;
+#ifdef NO_ALLOCS
+	DIGIT_T q[MAX_FIXED_DIGITS + 2];
+	DIGIT_T mm[MAX_FIXED_DIGITS + 2];
+	DIGIT_T p[(MAX_FIXED_DIGITS + 2) * 2];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *q, *mm, *p;
+	q = mpAlloc(kk);
+	mm = mpAlloc(kk);
+	p = mpAlloc(kk * 2);
+#endif
+
+	/* q = floor(floor(x / B^(k-1)) * mu / B^(k+1)) */
+	mpSetZero(q, kk);
+	mpSetEqual(q, &x[k - 1], k + 1);
+	mpMultiply(p, q, mu, kk);
+	mpSetZero(q, kk);
+	mpSetEqual(q, &p[k + 1], k + 1);
+
+	/* p = (x - q * m) mod B^(k+1), which is below 3m */
+	mpSetZero(mm, kk);
+	mpSetEqual(mm, m, k);
+	mpMultiply(p, q, mm, kk);
+	mpSubtract(q, x, p, k + 1);
+	while (mpCompare(q, mm, k + 1) >= 0)
+		mpSubtract(q, q, mm, k + 1);
+
+	mpSetZero(r, ndigits);
+	mpSetEqual(r, q, k);
+
+	mpDESTROY(q, kk);
+	mpDESTROY(mm, kk);
+	mpDESTROY(p, kk * 2);
+
+	return 0;
+}
+
+#ifndef NO_ALLOCS
+static const DIGIT_T *mpBarrettCached(DIGIT_T m[], size_t ndigits)
+{	/*	Returns the Barrett reciprocal of m if m was also the modulus of
+		the previous call on this thread, else remembers m and returns
+		NULL. Setting up mu costs about one long division so it only
+		pays once a modulus is reused. */
+	if (barrett_ndigits == ndigits && mpEqual(barrett_m, m, ndigits))
+	{
+		if (!barrett_ready)
+		{
+			mpBarrettInit(barrett_mu, m, ndigits);
+			barrett_ready = 1;
+		}
+		return barrett_mu;
+	}
+
+	if (barrett_ndigits != ndigits)
+	{
+		free(barrett_m);
+		free(barrett_mu);
+		barrett_m = (DIGIT_T *)calloc(ndigits, sizeof(DIGIT_T));
+		barrett_mu = (DIGIT_T *)calloc(ndigits + 2, sizeof(DIGIT_T));
+		if (!barrett_m || !barrett_mu)
+			mpFail("mpBarrettCached: Unable to allocate memory.");
+		barrett_ndigits = ndigits;
+	}
+	mpSetEqual(barrett_m, m, ndigits);
+	barrett_ready = 0;
+
+	return NULL;
+}
+#endif
+
+static void mpModWide(DIGIT_T a[], const DIGIT_T p[], DIGIT_T m[], size_t ndigits)
+{	/*	Computes a = p mod m for p[2*ndigits] */
+#ifndef NO_ALLOCS
+	const DIGIT_T *mu;
+	size_t k = mpSizeof(m, ndigits);
+
+	/* Barrett needs p < B^(2k), true whenever the factors were below m */
+	if (k > 0 && mpSizeof(p, ndigits * 2) <= 2 * k && 
+		(mu = mpBarrettCached(m, ndigits)) != NULL)
+	{
+		mpBarrettReduce(a, p, m, mu, ndigits);
+		return;
+	}
+#endif
+	mpModulo(a, p, ndigits * 2, m, ndigits);
+}
+
 int mpModMult(DIGIT_T a[], const DIGIT_T x[], const DIGIT_T y[], 
 			  DIGIT_T m[], size_t ndigits)
 {	/*	Computes a = (x * y) mod m */
@@ -2062,7 +2502,7 @@ int mpModMult(DIGIT_T a[], const DIGIT_T x[], const DIGIT_T y[],
 	mpMultiply(p, x, y, ndigits);
 
 	/* Then modulo (NOTE: a is OK at only ndigits long) */
-	mpModulo(a, p, ndigits * 2, m, ndigits);
+	mpModWide(a, p, m, ndigits);
 
 	mpDESTROY(p, ndigits * 2);
 
@@ -2088,7 +2528,7 @@ int mpModSquare(DIGIT_T a[], const DIGIT_T x[], DIGIT_T m[], size_t ndigits)
 	mpSquare(p, x, ndigits);
 
 	/* Then modulo (NOTE: a is OK at only ndigits long) */
-	mpModulo(a, p, ndigits * 2, m, ndigits);
+	mpModWide(a, p, m, ndigits);
 
 	mpDESTROY(p, ndigits * 2);
 
@@ -2648,7 +3088,7 @@ done:
    Broke out mpRabinMiller() as a separate function
 */
 
-static DIGIT_T SMALL_PRIMES[] = {
+static const DIGIT_T SMALL_PRIMES[] = {
 	3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 
 	47, 53, 59, 61, 67, 71, 73, 79, 83, 89, 97, 101, 
 	103, 107, 109, 113,
@@ -2891,20 +3331,35 @@ size_t mpQuickRandBits(DIGIT_T a[], size_t ndigits, size_t nbits)
 
 /* Internal functions used for "simple" random numbers */
 
+/* Per-thread xorshift64* state replacing the shared rand()/srand() */
+static MP_THREAD_LOCAL uint64_t rand_state;
+
 static void rand_seed()
 /* [v2.2] Moved seeding process inside this function.
    Added clock() to time() to improve precision. 
    [v2.4] Extra fudge with time shifted left by 16
+   Now mixed into the calling thread's state along with the address of
+   that state, so threads seeded in the same tick still differ.
 */
 {
 	/* Seed with system time and clock */
 	unsigned int seed = (((unsigned int)time(NULL) & 0xFFFF) << 16) ^ (unsigned int)clock();
-	srand(seed);
+	rand_state ^= ((uint64_t)seed << 32) ^ (uint64_t)(uintptr_t)&rand_state;
+	if (rand_state == 0)
+		rand_state = 0x9E3779B97F4A7C15ULL;
+}
+
+static unsigned char rand_byte(void)
+{
+	rand_state ^= rand_state >> 12;
+	rand_state ^= rand_state << 25;
+	rand_state ^= rand_state >> 27;
+	return (unsigned char)((rand_state * 0x2545F4914F6CDD1DULL) >> 56);
 }
 
 static DIGIT_T rand_between(DIGIT_T lower, DIGIT_T upper)
 /* Returns a single pseudo-random digit between lower and upper.
-   Uses rand(). Assumes srand() already called. */
+   Uses rand_byte(). Assumes rand_seed() already called. */
 {
 	DIGIT_T d, range;
 	unsigned char *bp;
@@ -2916,11 +3371,11 @@ static DIGIT_T rand_between(DIGIT_T lower, DIGIT_T upper)
 
 	do
 	{
-		/* Generate a random DIGIT byte-by-byte using rand() */
+		/* Generate a random DIGIT byte-by-byte */
 		bp = (unsigned char *)&d;
 		for (i = 0; i < sizeof(DIGIT_T); i++)
 		{
-			bp[i] = (unsigned char)(rand() & 0xFF);
+			bp[i] = rand_byte();
 		}
 
 		/* Trim to next highest bit above required range */
@@ -2949,10 +3404,10 @@ DIGIT_T spSimpleRand(DIGIT_T lower, DIGIT_T upper)
 {	/*	Returns a pseudo-random digit.
 		Handles own seeding using time.
 		NOT for cryptographically-secure random numbers.
-		NOT thread-safe because of static variable.
+		Seeding and state are per thread.
 		Changed in Version 2 to use internal funcs.
 	*/
-	static unsigned seeded = 0;
+	static MP_THREAD_LOCAL unsigned seeded = 0;
 
 	if (!seeded)
 	{
@@ -2971,10 +3426,16 @@ DIGIT_T spSimpleRand(DIGIT_T lower, DIGIT_T upper)
 
 static int mpModExp_1(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
 static int mpModExp_windowed(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
+static int mpModExp_mont(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
+static int mpModExp_ladder(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
+static int mpModExpMont_ct(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits);
 
 /** Computes y = x^n mod d */
 int mpModExp(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], size_t ndigits)
 {
+	/* Odd moduli avoid long division altogether in the Montgomery domain */
+	if (mpISODD(d, ndigits))
+		return mpModExp_mont(y, x, n, d, ndigits);
 #ifdef NO_ALLOCS
 	return mpModExp_1(y, x, n, d, ndigits);
 #else
@@ -2990,6 +3451,9 @@ int mpModExp(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T n[], DIGIT_T d[], siz
 #define mpMODMULTTEMP(y,x,m,n,t1,t2) do{mpMultiply(t1,x,y,n);mpDivide(t2,y,t1,n*2,m,n);}while(0)
 /* Mult:   w = (y * x) mod m */
 #define mpMODMULTXYTEMP(w,y,x,m,n,t1,t2) do{mpMultiply(t1,x,y,(n));mpDivide(t2,w,t1,(n)*2,m,(n));}while(0)
+/* As above but reducing with a Barrett reciprocal mu; needs y, x < m */
+#define mpMODSQUAREBARRETT(y,m,mu,n,t1) do{mpSquare(t1,y,n);mpBarrettReduce(y,t1,m,mu,n);}while(0)
+#define mpMODMULTBARRETT(y,x,m,mu,n,t1) do{mpMultiply(t1,x,y,n);mpBarrettReduce(y,t1,m,mu,n);}while(0)
 
 static int mpModExp_1(DIGIT_T yout[], const DIGIT_T x[], const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
 {	/*	Computes y = x^e mod m */
@@ -3058,8 +3522,18 @@ done:
 	return 0;
 }
 
-/**	Computes y = x^e mod m in constant time using Coron's algorithm */
+/**	Computes y = x^e mod m in constant time: fixed windows in the Montgomery
+	domain for odd m, otherwise Coron's ladder (mpModExp_ladder) */
 int mpModExp_ct(DIGIT_T yout[], const DIGIT_T x[], const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
+{
+	/* Odd moduli use fixed windows in the Montgomery domain, about
+	   the cost of mpModExp() rather than a multiply for every bit */
+	if (mpISODD(m, ndigits))
+		return mpModExpMont_ct(yout, x, e, m, ndigits);
+	return mpModExp_ladder(yout, x, e, m, ndigits);
+}
+
+static int mpModExp_ladder(DIGIT_T yout[], const DIGIT_T x[], const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
 {	
 	/* Algorithm: Corons exponentiation (left-to-right)
 	 * Square-and-multiply resistant against simple power attacks (SPA)
@@ -3146,6 +3620,19 @@ done:
 }
 
 
+/* 
+Optimal values of k for various exponent sizes.
+	The references on this differ in their recommendations. 
+	These values reflect experiments we've done on our systems.
+	You can adjust this to suit your own situation.
+*/
+static const size_t WindowLenTable[] = 
+{
+/* k=1   2   3   4    5     6     7     8 */
+	 5, 16, 64, 240, 768, 1024, 2048, 4096
+};
+#define WINLENTBLMAX (sizeof(WindowLenTable)/sizeof(WindowLenTable[0]))
+
 /* Use sliding window alternative only if NO_ALLOCS not defined */
 #ifndef NO_ALLOCS
 
@@ -3170,19 +3657,6 @@ and e_l = 1, and do the following:
 4. Return(A).
 */
 
-/* 
-Optimal values of k for various exponent sizes.
-	The references on this differ in their recommendations. 
-	These values reflect experiments we've done on our systems.
-	You can adjust this to suit your own situation.
-*/
-static size_t WindowLenTable[] = 
-{
-/* k=1   2   3   4    5     6     7     8 */
-	 5, 16, 64, 240, 768, 1024, 2048, 4096
-};
-#define WINLENTBLMAX (sizeof(WindowLenTable)/sizeof(WindowLenTable[0]))
-
 /*	The process used here to read bits into the lookahead buffer could be improved slightly as
 	some bits are read in more than once. But we think this function is tricky enough without 
 	adding more complexity for marginal benefit.
@@ -3205,7 +3679,8 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 	size_t ngt;		/* No of elements in gtable */
 	size_t idxmult;	/* Index (in gtable) of next multiplier to use: 0=g1, 1=g3, 2=g5,... */
 	DIGIT_T *g2;	/* g2 = g^2 */
-	DIGIT_T *temp1, *temp2;		/* Temp big digits, needed for MULT and SQUARE macros */
+	DIGIT_T *temp1;		/* Temp big digits, needed for MULT and SQUARE macros */
+	DIGIT_T *mu;	/* Barrett reciprocal of m */
 	DIGIT_T *a;		/* A */
 	int aisone;		/* Flag that A == 1 */
 	size_t nn;		/* 2 * ndigits */
@@ -3242,27 +3717,29 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 	/* Allocate temp vars - NOTE: all are 2n long */
 	nn = 2 * ndigits;
 	temp1 = mpAlloc(nn);
-	temp2 = mpAlloc(nn);
 	g2 = mpAlloc(nn);
 	a = mpAlloc(nn);
+	mu = mpAlloc(ndigits + 2);
 
 	/* 1. PRECOMPUTATION */
-	/* 1.1 g1 <-- g, (we already have g in the input, so just point to it) */
-	gtable[0] = (DIGIT_T *)g;
+	/* 1.0 One reciprocal replaces a long division per step */
+	mpBarrettInit(mu, m, ndigits);
+	/* 1.1 g1 <-- g mod m */
+	gtable[0] = mpAlloc(nn);
+	mpModulo(gtable[0], g, ndigits, m, ndigits);
 	/* g2 <-- g^2 */
-	mpModMult(g2, gtable[0], gtable[0], m, ndigits);
+	mpSetEqual(g2, gtable[0], ndigits);
+	mpMODSQUAREBARRETT(g2, m, mu, ndigits, temp1);
 
 	/* 1.2 For i from 1 to (2^{k-1} - 1) do: g_{2i+1} <-- g_{2i-1} * g_2. */
 	/* i.e. we store (g1, g3, g5, g7,...) */
 	ngt = ((size_t)1 << (winlen - 1));
 	for (i = 1; i < ngt; i++)
 	{
-		/* NOTE: we need these elements to be 2n digits long for the mpMODMULTTEMP fn, 
-			but the final result is only n digits long */
 		gtable[i] = mpAlloc(nn);
 		//mpModMult(gtable[i], gtable[i-1], g2, m, ndigits);
 		mpSetEqual(gtable[i], gtable[i-1], ndigits);
-		mpMODMULTTEMP(gtable[i], g2, m, ndigits, temp1, temp2);
+		mpMODMULTBARRETT(gtable[i], g2, m, mu, ndigits, temp1);
 	}
 
 	/* 2. A <-- 1 (use flag) */
@@ -3288,7 +3765,7 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 		/* A <-- A^2 */
 		if (!aisone)	/* 1^2 = 1! */
 		{
-			mpMODSQUARETEMP(a, m, ndigits, temp1, temp2);
+			mpMODSQUAREBARRETT(a, m, mu, ndigits, temp1);
 		}
 
 		if (!in_window)
@@ -3350,7 +3827,7 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 			}
 			else
 			{
-				mpMODMULTTEMP(a, gtable[idxmult], m, ndigits, temp1, temp2);
+				mpMODMULTBARRETT(a, gtable[idxmult], m, mu, ndigits, temp1);
 			}
 			DPRINTF1("[%x]", idxmult);		
 			DPRINTF0("/ ");
@@ -3369,7 +3846,7 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 		}
 		else
 		{
-			mpMODMULTTEMP(a, gtable[idxmult], m, ndigits, temp1, temp2);
+			mpMODMULTBARRETT(a, gtable[idxmult], m, mu, ndigits, temp1);
 		}
 		DPRINTF1("[%x]", idxmult);		
 		DPRINTF0("//");
@@ -3383,12 +3860,318 @@ static int mpModExp_windowed(DIGIT_T yout[], const DIGIT_T g[],
 	mpDESTROY(a, nn);
 	mpDESTROY(g2, nn);
 	mpDESTROY(temp1, nn);
-	mpDESTROY(temp2, nn);
-	/* CAUTION: don't clean gtable[0] */
-	for (i = 1; i < ngt; i++)
+	mpDESTROY(mu, ndigits + 2);
+	for (i = 0; i < ngt; i++)
 		mpDESTROY(gtable[i], nn);
 
 	return 0;
 }
 
 #endif /* !NO_ALLOCS */
+
+/*****************************/
+/* MONTGOMERY MULTIPLICATION */
+/*****************************/
+/*	For odd m, R = 2^(BITS_PER_DIGIT * ndigits) and n' = -m^{-1} mod 2^BITS_PER_DIGIT
+	the Montgomery product x * y * R^{-1} mod m can be computed without division.
+	Operands are kept in the Montgomery domain (x * R mod m) for the whole of an
+	exponentiation, so the only reductions are the ones interleaved in the product.
+	Ref: C.K. Koc, T. Acar, B.S. Kaliski, "Analyzing and Comparing Montgomery 
+	Multiplication Algorithms", IEEE Micro, 1996 (CIOS method).
+*/
+
+/* Largest window used by the Montgomery exponentiation (2^(k-1) table entries) */
+#define MONT_MAXWINLEN 6
+
+DIGIT_T mpMontInv(const DIGIT_T m[])
+{	/*	Returns n' = -m^{-1} mod 2^BITS_PER_DIGIT for odd m */
+	/*	Newton's iteration x <-- x(2 - mx) doubles the number of correct low bits
+		each time. x = m is already correct to 3 bits since m^2 = 1 mod 8. */
+	DIGIT_T inv = m[0];
+	int i;
+
+	for (i = 0; i < 5; i++)
+		inv *= 2 - m[0] * inv;
+
+	return (DIGIT_T)(0 - inv);
+}
+
+int mpMontR2(DIGIT_T r2[], DIGIT_T m[], size_t ndigits)
+{	/*	Computes r2 = R^2 mod m */
+	size_t nn = ndigits * 2 + 1;
+#ifdef NO_ALLOCS
+	DIGIT_T t[MAX_FIXED_DIGITS * 2 + 1];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *t;
+	t = mpAlloc(nn);
+#endif
+
+	mpSetZero(t, nn);
+	t[nn - 1] = 1;
+	mpModulo(r2, t, nn, m, ndigits);
+
+	mpDESTROY(t, nn);
+
+	return 0;
+}
+
+static void mpMontMult_t(DIGIT_T w[], const DIGIT_T x[], const DIGIT_T y[], 
+	const DIGIT_T m[], DIGIT_T minv, size_t ndigits, DIGIT_T t[])
+{	/*	Computes w = x * y * R^{-1} mod m using temp t[2*ndigits+1]. 
+		w may overlap x or y.
+		Product scanning (FIPS) form: each column of x * y + q * m is
+		summed in a Comba accumulator, the low columns choosing the
+		quotient digit q_k that clears them and the high ones giving
+		the result. Ref: Koc, Acar and Kaliski, "Analyzing and comparing
+		Montgomery multiplication algorithms", IEEE Micro 16(3), 1996. */
+	size_t i, j, k;
+	DIGIT_T c, u;
+	DIGIT2_T acc;
+	DIGIT_T *q = t;
+	DIGIT_T *r = t + ndigits;
+
+	acc = 0;
+	c = 0;
+	for (k = 0; k < ndigits; k++)
+	{
+		for (i = 0; i < k; i++)
+		{
+			mpCOMBA_MULADD(acc, c, x[i], y[k - i]);
+			mpCOMBA_MULADD(acc, c, q[i], m[k - i]);
+		}
+		mpCOMBA_MULADD(acc, c, x[k], y[0]);
+		q[k] = (DIGIT_T)acc * minv;
+		mpCOMBA_MULADD(acc, c, q[k], m[0]);
+		/* Column k is now zero; drop it */
+		acc = (acc >> BITS_PER_DIGIT) | ((DIGIT2_T)c << BITS_PER_DIGIT);
+		c = 0;
+	}
+	for (k = ndigits; k < 2 * ndigits - 1; k++)
+	{
+		for (i = k - ndigits + 1; i < ndigits; i++)
+		{
+			mpCOMBA_MULADD(acc, c, x[i], y[k - i]);
+			mpCOMBA_MULADD(acc, c, q[i], m[k - i]);
+		}
+		mpCOMBA_STORE(r, k - ndigits, acc, c);
+	}
+	r[ndigits - 1] = (DIGIT_T)acc;
+	r[ndigits] = (DIGIT_T)(acc >> BITS_PER_DIGIT);
+
+	/* r < 2m so at most one subtraction is needed. Both results are
+	   formed and one picked by mask so the choice doesn't branch. */
+	u = 0 - (r[ndigits] | (mpSubtract(w, r, m, ndigits) ^ 1));
+	for (j = 0; j < ndigits; j++)
+		w[j] = (w[j] & u) | (r[j] & ~u);
+}
+
+void mpMontMult(DIGIT_T w[], const DIGIT_T x[], const DIGIT_T y[], 
+	const DIGIT_T m[], DIGIT_T minv, size_t ndigits)
+{	/*	Computes w = x * y * R^{-1} mod m */
+	size_t nt = 2 * ndigits + 1;
+#ifdef NO_ALLOCS
+	DIGIT_T t[2 * MAX_FIXED_DIGITS + 1];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *t;
+	t = mpAlloc(nt);
+#endif
+
+	mpMontMult_t(w, x, y, m, minv, ndigits, t);
+
+	mpDESTROY(t, nt);
+}
+
+int mpModExpMont(DIGIT_T yout[], const DIGIT_T x[], const DIGIT_T e[], 
+	const DIGIT_T m[], DIGIT_T minv, const DIGIT_T r2[], size_t ndigits)
+{	/*	Computes y = x^e mod m for odd m, x < m, using sliding-window
+		exponentiation in the Montgomery domain. */
+	size_t nbits;	/* Number of significant bits in e */
+	size_t winlen;	/* Window size */
+	size_t ngt;		/* No of elements in gtable: g1, g3, g5,... */
+	size_t i, j, l;
+	DIGIT_T val;
+	int aisone;
+	size_t nt = 2 * ndigits + 1;
+#ifdef NO_ALLOCS
+	DIGIT_T gtable[((size_t)1 << (MONT_MAXWINLEN-1)) * MAX_FIXED_DIGITS];
+	DIGIT_T a[MAX_FIXED_DIGITS];
+	DIGIT_T g2[MAX_FIXED_DIGITS];
+	DIGIT_T t[2 * MAX_FIXED_DIGITS + 1];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *gtable, *a, *g2, *t;
+#endif
+
+	nbits = mpBitLength(e, ndigits);
+	if (nbits == 0)
+	{	/* g^0 = 1 */
+		mpSetDigit(yout, 1, ndigits);
+		return 0;
+	}
+
+	for (winlen = 0; winlen < WINLENTBLMAX; winlen++)
+	{
+		if (WindowLenTable[winlen] > nbits)
+			break;
+	}
+	if (winlen < 1)
+		winlen = 1;
+	if (winlen > MONT_MAXWINLEN)
+		winlen = MONT_MAXWINLEN;
+	ngt = ((size_t)1 << (winlen - 1));
+
+#ifndef NO_ALLOCS
+	gtable = mpAlloc(ngt * ndigits);
+	a = mpAlloc(ndigits);
+	g2 = mpAlloc(ndigits);
+	t = mpAlloc(nt);
+#endif
+
+	/* g1 = x * R mod m, then g_{2i+1} = g_{2i-1} * g^2 */
+	mpMontMult_t(gtable, x, r2, m, minv, ndigits, t);
+	if (ngt > 1)
+	{
+		mpMontMult_t(g2, gtable, gtable, m, minv, ndigits, t);
+		for (i = 1; i < ngt; i++)
+			mpMontMult_t(&gtable[i * ndigits], &gtable[(i-1) * ndigits], g2, m, minv, ndigits, t);
+	}
+
+	/* Scan e left to right; the current bit is e_{i-1} */
+	aisone = 1;
+	i = nbits;
+	while (i > 0)
+	{
+		if (!mpGETBIT(e, i - 1))
+		{	/* A <-- A^2 */
+			if (!aisone)
+				mpMontMult_t(a, a, a, m, minv, ndigits, t);
+			i--;
+			continue;
+		}
+
+		/* Longest window e_{i-1}..e_l of at most winlen bits with e_l = 1 */
+		l = (i > winlen ? i - winlen : 0);
+		while (!mpGETBIT(e, l))
+			l++;
+		for (val = 0, j = i; j > l; j--)
+			val = (val << 1) | mpGETBIT(e, j - 1);
+
+		/* A <-- A^{2^(i-l)} * g_val */
+		if (aisone)
+		{
+			mpSetEqual(a, &gtable[(val >> 1) * ndigits], ndigits);
+			aisone = 0;
+		}
+		else
+		{
+			for (j = l; j < i; j++)
+				mpMontMult_t(a, a, a, m, minv, ndigits, t);
+			mpMontMult_t(a, a, &gtable[(val >> 1) * ndigits], m, minv, ndigits, t);
+		}
+		i = l;
+	}
+
+	/* Leave the Montgomery domain: y = A * 1 * R^{-1} */
+	mpSetDigit(g2, 1, ndigits);
+	mpMontMult_t(yout, a, g2, m, minv, ndigits, t);
+
+	mpDESTROY(gtable, ngt * ndigits);
+	mpDESTROY(a, ndigits);
+	mpDESTROY(g2, ndigits);
+	mpDESTROY(t, nt);
+
+	return 0;
+}
+
+static int mpModExp_mont(DIGIT_T yout[], const DIGIT_T x[], 
+	const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
+{	/*	Computes y = x^e mod m for odd m */
+#ifdef NO_ALLOCS
+	DIGIT_T r2[MAX_FIXED_DIGITS];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *r2;
+	r2 = mpAlloc(ndigits);
+#endif
+
+	mpMontR2(r2, m, ndigits);
+	mpModExpMont(yout, x, e, m, mpMontInv(m), r2, ndigits);
+
+	mpDESTROY(r2, ndigits);
+
+	return 0;
+}
+
+#define MONT_CT_WINLEN 4
+
+static int mpModExpMont_ct(DIGIT_T yout[], const DIGIT_T x[], 
+	const DIGIT_T e[], DIGIT_T m[], size_t ndigits)
+{	/*	Computes y = x^e mod m for odd m using fixed windows over all
+		ndigits of e. Every window costs the same squarings and one
+		multiply, and each table lookup reads every entry, so neither
+		the operations nor the memory accesses depend on e. */
+	size_t i, j, k;
+	DIGIT_T w, mask, minv;
+	size_t ngt = (size_t)1 << MONT_CT_WINLEN;
+	size_t nt = 2 * ndigits + 1;
+#ifdef NO_ALLOCS
+	DIGIT_T gtable[((size_t)1 << MONT_CT_WINLEN) * MAX_FIXED_DIGITS];
+	DIGIT_T a[MAX_FIXED_DIGITS];
+	DIGIT_T g[MAX_FIXED_DIGITS];
+	DIGIT_T r2[MAX_FIXED_DIGITS];
+	DIGIT_T t[2 * MAX_FIXED_DIGITS + 1];
+	assert(ndigits <= MAX_FIXED_DIGITS);
+#else
+	DIGIT_T *gtable, *a, *g, *r2, *t;
+	gtable = mpAlloc(ngt * ndigits);
+	a = mpAlloc(ndigits);
+	g = mpAlloc(ndigits);
+	r2 = mpAlloc(ndigits);
+	t = mpAlloc(nt);
+#endif
+
+	minv = mpMontInv(m);
+	mpMontR2(r2, m, ndigits);
+
+	/* g_0 = R mod m, g_1 = x * R mod m, g_k = g_{k-1} * g_1 */
+	mpSetDigit(g, 1, ndigits);
+	mpMontMult_t(gtable, g, r2, m, minv, ndigits, t);
+	mpModulo(g, x, ndigits, m, ndigits);
+	mpMontMult_t(&gtable[ndigits], g, r2, m, minv, ndigits, t);
+	for (k = 2; k < ngt; k++)
+		mpMontMult_t(&gtable[k * ndigits], &gtable[(k-1) * ndigits], &gtable[ndigits], m, minv, ndigits, t);
+
+	mpSetEqual(a, gtable, ndigits);
+	for (i = ndigits * BITS_PER_DIGIT; i > 0; i -= MONT_CT_WINLEN)
+	{
+		for (j = 0; j < MONT_CT_WINLEN; j++)
+			mpMontMult_t(a, a, a, m, minv, ndigits, t);
+
+		/* Window e_{i-1}..e_{i-4}; BITS_PER_DIGIT is a multiple of its length */
+		w = (e[(i - MONT_CT_WINLEN) / BITS_PER_DIGIT] >> ((i - MONT_CT_WINLEN) % BITS_PER_DIGIT)) & (ngt - 1);
+
+		mpSetZero(g, ndigits);
+		for (k = 0; k < ngt; k++)
+		{	/* mask is all ones only for k == w */
+			mask = (DIGIT_T)k ^ w;
+			mask = ((mask | (0 - mask)) >> (BITS_PER_DIGIT - 1)) - 1;
+			for (j = 0; j < ndigits; j++)
+				g[j] |= gtable[k * ndigits + j] & mask;
+		}
+		mpMontMult_t(a, a, g, m, minv, ndigits, t);
+	}
+
+	/* Leave the Montgomery domain: y = A * 1 * R^{-1} */
+	mpSetDigit(g, 1, ndigits);
+	mpMontMult_t(yout, a, g, m, minv, ndigits, t);
+
+	mpDESTROY(gtable, ngt * ndigits);
+	mpDESTROY(a, ndigits);
+	mpDESTROY(g, ndigits);
+	mpDESTROY(r2, ndigits);
+	mpDESTROY(t, nt);
+
+	return 0;
+}
@@ -34,6 +34,23 @@
 /* [v2.1] Changed to use C99 exact-width types. */
 /* [v2.2] Put macros for exact-width types in separate file "bigdtypes.h" */
 
+/*	Define USE_DIGIT64 to use 64-bit digits with 128-bit intermediate
+	products. Requires a compiler with unsigned __int128 (GCC/Clang on
+	64-bit targets). Halves the number of digits in every operand.
+*/
+#ifdef USE_DIGIT64
+/** The basic BigDigit element, an unsigned 64-bit integer */
+typedef uint64_t DIGIT_T;
+/** @cond */
+typedef uint32_t HALF_DIGIT_T;
+
+/* Sizes to match */
+#define MAX_DIGIT 0xFFFFFFFFFFFFFFFFULL
+#define MAX_HALF_DIGIT 0xFFFFFFFFULL
+#define BITS_PER_DIGIT 64
+#define HIBITMASK 0x8000000000000000ULL
+/** @endcond */
+#else
 /** The basic BigDigit element, an unsigned 32-bit integer */
 typedef uint32_t DIGIT_T;
 /** @cond */
@@ -44,6 +61,9 @@ typedef uint16_t HALF_DIGIT_T;
 #define MAX_HALF_DIGIT 0xFFFFUL	/* NB 'L' */
 #define BITS_PER_DIGIT 32
 #define HIBITMASK 0x80000000UL
+/** @endcond */
+#endif
+/** @cond */
 
 /*	[v2.2] added option to avoid allocating temp storage in the heap
 	and use (faster) fixed automatic arrays on the stack instead.
@@ -71,6 +91,7 @@ typedef uint16_t HALF_DIGIT_T;
    USE_64WITH32: to use the 64-bit integers if available (e.g. long long).
    Default: use default internal routines spDivide and spMultiply.
    The USE_SPASM option takes precedence over USE_64WITH32.
+   USE_DIGIT64 (see above) takes precedence over both.
 */
 
 /* Useful macros */
@@ -219,6 +240,41 @@ int mpModMult(DIGIT_T a[], const DIGIT_T x[], const DIGIT_T y[], DIGIT_T m[], si
 /** Computes a = x^2 mod m */
 int mpModSquare(DIGIT_T a[], const DIGIT_T x[], DIGIT_T m[], size_t ndigits);
 
+/** Computes the Barrett reciprocal mu = floor(B^(2k) / m) where k = mpSizeof(m)
+@param[out] mu must be at least `ndigits+2` digits long
+@pre m != 0
+*/
+int mpBarrettInit(DIGIT_T mu[], DIGIT_T m[], size_t ndigits);
+
+/** Computes r = x mod m using the reciprocal from mpBarrettInit()
+@param[in] x is `2*ndigits` digits long
+@pre x < B^(2k), e.g. x is the product of two values less than m
+@remark Costs two multiplications instead of a long division. `r` may overlap `x`.
+*/
+int mpBarrettReduce(DIGIT_T r[], const DIGIT_T x[], const DIGIT_T m[], const DIGIT_T mu[], size_t ndigits);
+
+/** Returns the Montgomery constant n' = -m^{-1} mod 2^BITS_PER_DIGIT
+@pre `m` is odd
+*/
+DIGIT_T mpMontInv(const DIGIT_T m[]);
+
+/** Computes r2 = R^2 mod m where R = 2^(BITS_PER_DIGIT * ndigits) */
+int mpMontR2(DIGIT_T r2[], DIGIT_T m[], size_t ndigits);
+
+/** Computes the Montgomery product w = x * y * R^{-1} mod m
+@param[in] minv Montgomery constant from mpMontInv()
+@pre `m` is odd and x, y < m
+*/
+void mpMontMult(DIGIT_T w[], const DIGIT_T x[], const DIGIT_T y[], const DIGIT_T m[], DIGIT_T minv, size_t ndigits);
+
+/** Computes y = x^e mod m in the Montgomery domain using precomputed constants
+@param[in] minv Montgomery constant from mpMontInv()
+@param[in] r2 R^2 mod m from mpMontR2()
+@pre `m` is odd and x < m
+@remark mpModExp() uses this automatically for odd moduli.
+*/
+int mpModExpMont(DIGIT_T y[], const DIGIT_T x[], const DIGIT_T e[], const DIGIT_T m[], DIGIT_T minv, const DIGIT_T r2[], size_t ndigits);
+
 /** Computes the inverse of `u` modulo `m`, inv = u^{-1} mod m */
 int mpModInv(DIGIT_T inv[], const DIGIT_T u[], const DIGIT_T m[], size_t ndigits);
 
@@ -561,6 +617,57 @@ DIGIT_T *mpAlloc(size_t ndigits);
 void mpFree(DIGIT_T **p);
 #endif
 void mpFail(char *msg);
+/** @endcond */
+
+/* Storage class for per-thread data */
+#if defined(_MSC_VER)
+#define MP_THREAD_LOCAL __declspec(thread)
+#elif defined(__GNUC__)
+#define MP_THREAD_LOCAL __thread
+#else
+#define MP_THREAD_LOCAL
+#endif
+
+/* THREAD SAFETY
+ * With MP_THREAD_LOCAL available the mp and bd functions keep no shared
+ * mutable state: scratch arenas, the Barrett cache, the simple RNG and
+ * the fail handler are all per thread. Inputs are never written (mpDivide()
+ * normalises a copy of its divisor), so threads may share read-only
+ * operands such as a key, provided each BIGD input has room for the
+ * calculation beforehand (see bdReserve()).
+ */
+
+/** TYPEDEF for a per-thread handler called by mpFail() instead of exiting
+ *  @remark Must not return, e.g. longjmp() back to where the work began.
+ */
+typedef void (* MP_FAILFUNC)(const char *msg, void *arg);
+
+/** Sets the calling thread's mpFail() handler; NULL restores printing the message and exiting.
+ *  @remark Scratch scopes opened after the handler was set are closed before it is
+ *  called, but heap temporaries of the failed calculation are leaked.
+ */
+void mpSetFailHandler(MP_FAILFUNC fn, void *arg);
+
+/** Opens a scratch scope on the calling thread.
+ *  Until the matching mpScratchEnd(), temporaries from mpAlloc() are carved
+ *  from a per-thread arena that is kept between scopes. The first scopes may
+ *  still fall back to the heap; the arena is grown to the peak seen when the
+ *  next outermost scope opens, so repeated identical work stops allocating.
+ *  @returns Mark to pass to mpScratchEnd(). Scopes may nest.
+ *  @remark Ignored if NO_ALLOCS is defined.
+ */
+size_t mpScratchBegin(void);
+
+/** Closes the scratch scope opened by the mpScratchBegin() that returned `mark`,
+ *  zeroising the arena space used inside it.
+ *  @pre All mpAlloc() temporaries from the scope have been freed.
+ */
+void mpScratchEnd(size_t mark);
+
+/** Returns the calling thread's scratch arena to the heap. */
+void mpScratchRelease(void);
+
+/** @cond */
 
 /* Clean up by zeroising and freeing allocated memory */
 #ifdef NO_ALLOCS
@@ -64,8 +64,14 @@ You can override by defining HAVE_C99INCLUDES or HAVE_SYS_TYPES.
 #endif
 /* We define our own 
 -- Example: ``printf("%" PRIxBIGD "\n", d);`` */
+#ifdef USE_DIGIT64
+#define PRIuBIGD PRIu64
+#define PRIxBIGD PRIx64
+#define PRIXBIGD PRIX64
+#else
 #define PRIuBIGD PRIu32
 #define PRIxBIGD PRIx32
 #define PRIXBIGD PRIX32
+#endif
 
 #endif /* BIGDTYPES_H_ */
@@ -21,6 +21,18 @@
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#include <fcntl.h>
+#include <io.h>
+#include <sys/stat.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 char *
 fileio_read_all(const char *filepath_,
                 size_t     *size_)
@@ -114,3 +126,190 @@ fileio_write_all(const char   *filepath_,
 
   return 0;
 }
+
+/*
+ * The file is created, or an existing one reset, with only the owner
+ * able to read and write it before anything is written.
+ */
+#if defined(_WIN32)
+static
+FILE*
+fopen_private(const char *filepath_)
+{
+  int fd;
+  FILE *file;
+
+  fd = _open(filepath_,_O_WRONLY|_O_CREAT|_O_TRUNC|_O_BINARY,_S_IREAD|_S_IWRITE);
+  if(fd < 0)
+    return NULL;
+
+  file = _fdopen(fd,"wb");
+  if(file == NULL)
+    _close(fd);
+
+  return file;
+}
+#else
+static
+FILE*
+fopen_private(const char *filepath_)
+{
+  int fd;
+  FILE *file;
+
+  fd = open(filepath_,O_WRONLY|O_CREAT|O_TRUNC,0600);
+  if(fd < 0)
+    return NULL;
+
+  if(fchmod(fd,0600) != 0)
+    {
+      close(fd);
+      return NULL;
+    }
+
+  file = fdopen(fd,"wb");
+  if(file == NULL)
+    close(fd);
+
+  return file;
+}
+#endif
+
+int
+fileio_write_private(const char   *filepath_,
+                     const void   *data_,
+                     const size_t  size_)
+{
+  int rv;
+  FILE *file;
+  size_t written;
+
+  file = fopen_private(filepath_);
+  if(file == NULL)
+    {
+      fprintf(stderr,
+              "ERROR: failed to open output file '%s' - %s\n",
+              filepath_,
+              strerror(errno));
+      return -1;
+    }
+
+  rv = 0;
+  written = fwrite(data_,1,size_,file);
+  if(written != size_)
+    {
+      fprintf(stderr,
+              "ERROR: failed to write file fully - %zu / %zu bytes - %s\n",
+              written,
+              size_,
+              filepath_);
+      rv = -1;
+    }
+
+  if(fclose(file) != 0)
+    rv = -1;
+
+  return rv;
+}
+
+#if defined(_WIN32)
+const void*
+fileio_map(const char *filepath_,
+           size_t     *size_)
+{
+  void *buf;
+  HANDLE file;
+  HANDLE mapping;
+  LARGE_INTEGER size;
+
+  file = CreateFileA(filepath_,GENERIC_READ,FILE_SHARE_READ,NULL,
+                     OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if(file == INVALID_HANDLE_VALUE)
+    {
+      fprintf(stderr,"ERROR: failed to open file '%s'\n",filepath_);
+      return NULL;
+    }
+
+  if(!GetFileSizeEx(file,&size) || (size.QuadPart == 0))
+    {
+      fprintf(stderr,"ERROR: unable to map empty file '%s'\n",filepath_);
+      CloseHandle(file);
+      return NULL;
+    }
+
+  mapping = CreateFileMappingA(file,NULL,PAGE_READONLY,0,0,NULL);
+  CloseHandle(file);
+  if(mapping == NULL)
+    {
+      fprintf(stderr,"ERROR: failed to map file '%s'\n",filepath_);
+      return NULL;
+    }
+
+  buf = MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+  CloseHandle(mapping);
+  if(buf == NULL)
+    {
+      fprintf(stderr,"ERROR: failed to map file '%s'\n",filepath_);
+      return NULL;
+    }
+
+  *size_ = (size_t)size.QuadPart;
+
+  return buf;
+}
+
+void
+fileio_unmap(const void *buf_,
+             size_t      size_)
+{
+  UnmapViewOfFile(buf_);
+}
+#else
+const void*
+fileio_map(const char *filepath_,
+           size_t     *size_)
+{
+  int fd;
+  void *buf;
+  struct stat st;
+
+  fd = open(filepath_,O_RDONLY);
+  if(fd < 0)
+    {
+      fprintf(stderr,
+              "ERROR: failed to open file '%s' - %s\n",
+              filepath_,
+              strerror(errno));
+      return NULL;
+    }
+
+  if((fstat(fd,&st) < 0) || (st.st_size == 0))
+    {
+      fprintf(stderr,"ERROR: unable to map empty file '%s'\n",filepath_);
+      close(fd);
+      return NULL;
+    }
+
+  buf = mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if(buf == MAP_FAILED)
+    {
+      fprintf(stderr,
+              "ERROR: failed to map file '%s' - %s\n",
+              filepath_,
+              strerror(errno));
+      return NULL;
+    }
+
+  *size_ = st.st_size;
+
+  return buf;
+}
+
+void
+fileio_unmap(const void *buf_,
+             size_t      size_)
+{
+  munmap((void*)buf_,size_);
+}
+#endif
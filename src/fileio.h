@@ -25,3 +25,10 @@ char *fileio_read_all(const char *filepath,
 int   fileio_write_all(const char   *filepath,
                        const void   *data,
                        const size_t  size);
+int   fileio_write_private(const char   *filepath,
+                           const void   *data,
+                           const size_t  size);
+const void *fileio_map(const char *filepath,
+                       size_t     *size);
+void        fileio_unmap(const void *buf,
+                         size_t      size);
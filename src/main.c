@@ -16,17 +16,26 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "bigdigits.h"
 #include "fileio.h"
 #include "md5.h"
+#include "parallel.h"
 #include "simple-opt.h"
+#include "skip_cache.h"
 #include "str.h"
 #include "tdo_aif.h"
+#include "tdo_aif_fingerprint.h"
+#include "tdo_aif_kat.h"
 #include "tdo_aif_signing.h"
+#include "tdo_keyfile.h"
+#include "tdo_keygen.h"
 
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #define MODBIN_VERSION "1.4.0"
@@ -35,7 +44,8 @@ static
 struct simple_opt*
 simple_opt_options(void)
 {
-  static const char *key_set[] = {"app","3do",NULL};
+  static const char *key_set[] = {"app","3do","app,3do","3do,app",NULL};
+  static const char *verify_set[] = {"app","3do","auto",NULL};
   static struct simple_opt options[] =
     {
      {SIMPLE_OPT_FLAG,       'h',"help",       false, "print this help message and exit"},
@@ -55,13 +65,929 @@ simple_opt_options(void)
      {SIMPLE_OPT_STRING,    '\0',"name",       true,  "executable name"},
      {SIMPLE_OPT_FLAG,      '\0',"time",       false, "set time"},
      {SIMPLE_OPT_FLAG,      '\0',"reset",      false, "resets all values to default"},
-     {SIMPLE_OPT_STRING_SET,'\0',"sign",       true,  "sign executable","app|3do", key_set},
+     {SIMPLE_OPT_STRING_SET,'\0',"sign",       true,  "sign executable","app|3do|app,3do", key_set},
+     {SIMPLE_OPT_STRING,    '\0',"keyfile",    true,  "sign or verify with an external key","PATH"},
+     {SIMPLE_OPT_FLAG,      '\0',"constant-time",false,"sign with constant time exponentiation"},
+     {SIMPLE_OPT_FLAG,      '\0',"blind",      false, "blind the message while signing"},
+     {SIMPLE_OPT_FLAG,      '\0',"benchmark",  false, "report signing throughput per mode"},
+     {SIMPLE_OPT_FLAG,      '\0',"selftest",   false, "check signing against known answers"},
+     {SIMPLE_OPT_UNSIGNED,  '\0',"genkey",     true,  "generate an RSA key file","BITS"},
+     {SIMPLE_OPT_STRING,    '\0',"sig-cache",  true,  "reuse signatures recorded in PATH","PATH"},
+     {SIMPLE_OPT_FLAG,      '\0',"fingerprint",false, "group inputs by header-normalized md5"},
+     {SIMPLE_OPT_STRING_SET,'\0',"verify",     false, "verify signatures (default: auto)","app|3do|auto", verify_set},
+     {SIMPLE_OPT_FLAG,      '\0',"batch",      false, "modify and sign all inputs in place"},
+     {SIMPLE_OPT_STRING,    '\0',"skip-cache", true,  "skip inputs --batch left unchanged","PATH"},
      {SIMPLE_OPT_END}
     };
 
   return options;
 }
 
+static
+struct simple_opt*
+option_find(struct simple_opt *options_,
+            const char        *long_name_)
+{
+  for(int i = 0; options_[i].type != SIMPLE_OPT_END; i++)
+    {
+      if(options_[i].long_name == NULL)
+        continue;
+      if(streq(options_[i].long_name,long_name_))
+        return &options_[i];
+    }
+
+  return NULL;
+}
+
+static
+bool
+option_seen(struct simple_opt *options_,
+            const char        *long_name_)
+{
+  struct simple_opt *opt;
+
+  opt = option_find(options_,long_name_);
+
+  return ((opt != NULL) && opt->was_seen);
+}
+
+static
+void
+apply_header_options(struct simple_opt  *options_,
+                     void               *buf_,
+                     size_t             *size_)
+{
+  for(int i = 0; options_[i].type != SIMPLE_OPT_END; i++)
+    {
+      if(!options_[i].was_seen)
+        continue;
+      if(options_[i].long_name == NULL)
+        continue;
+
+      if(streq(options_[i].long_name,"debug"))
+        tdo_aif_set_debug(buf_);
+      else if(streq(options_[i].long_name,"nodebug"))
+        tdo_aif_set_nodebug(buf_);
+      else if(streq(options_[i].long_name,"subsystype"))
+        tdo_aif_set_subsystype(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"type"))
+        tdo_aif_set_type(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"pri"))
+        tdo_aif_set_priority(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"version"))
+        tdo_aif_set_version(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"flags"))
+        tdo_aif_set_flags(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"osversion"))
+        tdo_aif_set_osversion(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"osrevision"))
+        tdo_aif_set_osrevision(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"stack"))
+        tdo_aif_set_stack(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"freespace"))
+        tdo_aif_set_freespace(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"maxusecs"))
+        tdo_aif_set_maxusecs(buf_,options_[i].val.v_unsigned);
+      else if(streq(options_[i].long_name,"name"))
+        tdo_aif_set_name(buf_,options_[i].val.v_string);
+      else if(streq(options_[i].long_name,"time"))
+        tdo_aif_set_time(buf_);
+      else if(streq(options_[i].long_name,"reset"))
+        tdo_aif_reset(buf_,size_);
+    }
+}
+
+/*
+ * The keys to sign with: a --keyfile or the built-ins named by --sign,
+ * which may name two separated by a comma. Returns the number of keys,
+ * 0 when neither option was given, or -1 on error.
+ */
+static
+int
+sign_keys(struct simple_opt    *options_,
+          const tdo_key_ctx_t **keys_)
+{
+  int n;
+  size_t len;
+  const char *name;
+  struct simple_opt *sign;
+  struct simple_opt *keyfile;
+  static const char *builtin[] = {"app","3do",NULL};
+
+  sign    = option_find(options_,"sign");
+  keyfile = option_find(options_,"keyfile");
+
+  if(sign->was_seen && keyfile->was_seen)
+    {
+      fprintf(stderr,"ERROR: --sign and --keyfile can't be used together\n");
+      return -1;
+    }
+
+  if(keyfile->was_seen)
+    {
+      keys_[0] = tdo_key_ctx_get_file(keyfile->val.v_string);
+      return ((keys_[0] == NULL) ? -1 : 1);
+    }
+
+  if(!sign->was_seen)
+    return 0;
+
+  n = 0;
+  for(name = sign->string_set[sign->val.v_string_set_idx]; ; name += (len + 1))
+    {
+      len = strcspn(name,",");
+      for(int i = 0; builtin[i] != NULL; i++)
+        {
+          if((strlen(builtin[i]) != len) || memcmp(builtin[i],name,len))
+            continue;
+          keys_[n] = tdo_key_ctx_get(builtin[i]);
+          if(keys_[n] == NULL)
+            return -1;
+          n++;
+        }
+      if(name[len] == '\0')
+        break;
+    }
+
+  return n;
+}
+
+/* Number of keys --sign names without loading them */
+static
+int
+sign_key_count(struct simple_opt *options_)
+{
+  struct simple_opt *sign;
+
+  sign = option_find(options_,"sign");
+  if(!sign->was_seen)
+    return 0;
+
+  return (strchr(sign->string_set[sign->val.v_string_set_idx],',') ? 2 : 1);
+}
+
+/*
+ * The key to sign with when only one can be used. key_ is left NULL
+ * when no key was given.
+ */
+static
+int
+sign_key(struct simple_opt    *options_,
+         const tdo_key_ctx_t **key_)
+{
+  int n;
+  const tdo_key_ctx_t *keys[2];
+
+  *key_ = NULL;
+
+  n = sign_keys(options_,keys);
+  if(n < 0)
+    return -1;
+  if(n > 1)
+    {
+      fprintf(stderr,"ERROR: signing with two keys needs one input and an output per key\n");
+      return -1;
+    }
+
+  if(n == 1)
+    *key_ = keys[0];
+
+  return 0;
+}
+
+/*
+ * With --keyfile only that key is tried, otherwise the built-in keys
+ * selected by --verify's argument. Returns the number of keys.
+ */
+static
+size_t
+verify_keys(struct simple_opt   *options_,
+            const tdo_key_ctx_t *keys_[2])
+{
+  size_t n;
+  const char *name;
+  struct simple_opt *opt;
+  static const char *builtin[] = {"app","3do",NULL};
+
+  if(option_seen(options_,"keyfile"))
+    return (sign_key(options_,&keys_[0]) == 0);
+
+  opt  = option_find(options_,"verify");
+  name = (opt->arg_is_stored ? opt->string_set[opt->val.v_string_set_idx] : "auto");
+
+  n = 0;
+  for(size_t i = 0; builtin[i] != NULL; i++)
+    {
+      if(!streq(name,"auto") && !streq(name,builtin[i]))
+        continue;
+
+      keys_[n] = tdo_key_ctx_get(builtin[i]);
+      if(keys_[n] == NULL)
+        return 0;
+      n++;
+    }
+
+  return n;
+}
+
+typedef struct fingerprint_s fingerprint_t;
+struct fingerprint_s
+{
+  md5_digest_t  digest;
+  const char   *filepath;
+};
+
+static
+int
+fingerprint_cmp(const void *a_,
+                const void *b_)
+{
+  const fingerprint_t *a = a_;
+  const fingerprint_t *b = b_;
+
+  return memcmp(a->digest,b->digest,sizeof(md5_digest_t));
+}
+
+static
+int
+fingerprint_files(int    argc_,
+                  char **argv_)
+{
+  int rv;
+  int count;
+  fingerprint_t *fps;
+
+  fps = calloc(argc_,sizeof(fingerprint_t));
+  if(fps == NULL)
+    return -1;
+
+  rv    = 0;
+  count = 0;
+  for(int i = 0; i < argc_; i++)
+    {
+      void *buf;
+      size_t size;
+
+      buf = fileio_read_all(argv_[i],&size);
+      if(buf == NULL)
+        {
+          rv = -1;
+          continue;
+        }
+
+      if(!tdo_aif_is_aif(buf,size))
+        {
+          fprintf(stderr,"ERROR: does not appear to be a valid AIF file - %s\n",argv_[i]);
+          free(buf);
+          rv = -1;
+          continue;
+        }
+
+      tdo_aif_fingerprint(buf,size,fps[count].digest);
+      fps[count].filepath = argv_[i];
+      count++;
+
+      free(buf);
+    }
+
+  qsort(fps,count,sizeof(fingerprint_t),fingerprint_cmp);
+
+  for(int i = 0, j; i < count; i = j)
+    {
+      for(j = i + 1; j < count; j++)
+        {
+          if(fingerprint_cmp(&fps[i],&fps[j]) != 0)
+            break;
+        }
+
+      printf("fingerprint: ");
+      for(int k = 0; k < (int)sizeof(md5_digest_t); k++)
+        printf("%.2x",fps[i].digest[k]);
+      printf(" (%d)\n",(j - i));
+      for(int k = i; k < j; k++)
+        printf("  %s\n",fps[k].filepath);
+    }
+
+  free(fps);
+
+  return rv;
+}
+
+/*
+ * Only the digest and signature of each input are kept so the whole
+ * set can be checked in one batch. Inputs without a usable signature
+ * are left out of the batch and reported as failed.
+ */
+static
+int
+verify_files(const tdo_key_ctx_t *const *keys_,
+             size_t                      nkeys_,
+             int                         argc_,
+             char                      **argv_)
+{
+  int rv;
+  size_t count;
+  int *slot;
+  tdo_aif_verify_item_t *items;
+
+  slot  = calloc(argc_,sizeof(int));
+  items = calloc(argc_,sizeof(tdo_aif_verify_item_t));
+  if((slot == NULL) || (items == NULL))
+    {
+      free(items);
+      free(slot);
+      return -1;
+    }
+
+  count = 0;
+  for(int i = 0; i < argc_; i++)
+    {
+      void *buf;
+      size_t size;
+
+      slot[i] = -1;
+
+      buf = fileio_read_all(argv_[i],&size);
+      if(buf == NULL)
+        {
+          fprintf(stderr,"ERROR: unable to open file - %s\n",argv_[i]);
+          continue;
+        }
+
+      if(!tdo_aif_is_aif(buf,size))
+        fprintf(stderr,"ERROR: does not appear to be a valid AIF file - %s\n",argv_[i]);
+      else if(tdo_aif_verify_prepare(buf,size,argv_[i],&items[count]) == 0)
+        slot[i] = count++;
+
+      free(buf);
+    }
+
+  rv = tdo_aif_verify_batch(items,count,keys_,nkeys_);
+
+  for(int i = 0; i < argc_; i++)
+    {
+      if((slot[i] >= 0) && (items[slot[i]].key != NULL))
+        {
+          printf("%s: OK (%s)\n",argv_[i],items[slot[i]].key->name);
+        }
+      else
+        {
+          printf("%s: FAILED\n",argv_[i]);
+          rv = -1;
+        }
+    }
+
+  free(items);
+  free(slot);
+
+  return rv;
+}
+
+/*
+ * Signatures per second of CPU time, doubling the count until a run
+ * takes long enough to time with clock().
+ */
+static
+double
+benchmark_mode(const tdo_aif_sign_opts_t *opts_)
+{
+  clock_t t;
+  uint8_t sig[TDO_AIF_SIG_MAX_SIZE];
+  md5_digest_t digest;
+
+  memset(digest,0,sizeof(digest));
+  for(unsigned count = 64; ; count *= 2)
+    {
+      t = clock();
+      for(unsigned i = 0; i < count; i++)
+        {
+          digest[i % sizeof(digest)]++;
+          if(tdo_aif_sign_digest(opts_,digest,sig) < 0)
+            return 0;
+        }
+      t = (clock() - t);
+
+      if(t >= (CLOCKS_PER_SEC / 2))
+        return ((double)count * CLOCKS_PER_SEC / t);
+    }
+}
+
+enum
+  {
+   REDUCE_DIVIDE,
+   REDUCE_BARRETT,
+   REDUCE_MONTGOMERY
+  };
+
+/*
+ * Modular squarings per second modulo the key's n using long
+ * division, a Barrett reciprocal or Montgomery multiplication. Setup
+ * is done once outside the timed loop; it costs about one long
+ * division for either of the latter two.
+ */
+static
+double
+benchmark_reduce(const tdo_key_ctx_t *key_,
+                 int                  method_)
+{
+  clock_t t;
+  size_t ndigits;
+  DIGIT_T minv;
+  uint8_t octets[TDO_AIF_SIG_MAX_SIZE];
+  DIGIT_T n[TDO_AIF_SIG_MAX_SIZE / sizeof(DIGIT_T)];
+  DIGIT_T x[TDO_AIF_SIG_MAX_SIZE / sizeof(DIGIT_T)];
+  DIGIT_T mu[TDO_AIF_SIG_MAX_SIZE / sizeof(DIGIT_T) + 2];
+  DIGIT_T p[TDO_AIF_SIG_MAX_SIZE * 2 / sizeof(DIGIT_T)];
+
+  ndigits = ((key_->size + sizeof(DIGIT_T) - 1) / sizeof(DIGIT_T));
+  bdConvToOctets(key_->n,octets,key_->size);
+  mpConvFromOctets(n,ndigits,octets,key_->size);
+  bdConvToOctets(key_->d,octets,key_->size);
+  mpConvFromOctets(x,ndigits,octets,key_->size);
+
+  minv = mpMontInv(n);
+  mpBarrettInit(mu,n,ndigits);
+
+  for(unsigned count = 256; ; count *= 2)
+    {
+      t = clock();
+      for(unsigned i = 0; i < count; i++)
+        {
+          switch(method_)
+            {
+            case REDUCE_DIVIDE:
+              mpSquare(p,x,ndigits);
+              mpModulo(x,p,ndigits * 2,n,ndigits);
+              break;
+            case REDUCE_BARRETT:
+              mpSquare(p,x,ndigits);
+              mpBarrettReduce(x,p,n,mu,ndigits);
+              break;
+            case REDUCE_MONTGOMERY:
+              mpMontMult(p,x,x,n,minv,ndigits);
+              mpSetEqual(x,p,ndigits);
+              break;
+            }
+        }
+      t = (clock() - t);
+
+      if(t >= (CLOCKS_PER_SEC / 2))
+        return ((double)count * CLOCKS_PER_SEC / t);
+    }
+}
+
+static
+int
+benchmark_signing(const tdo_key_ctx_t *key_)
+{
+  double fast;
+  double rate;
+  tdo_aif_sign_opts_t opts;
+  static const struct { const char *name; bool ct; bool blind; } modes[] =
+    {
+     {"fast",               false, false},
+     {"constant-time",      true,  false},
+     {"constant-time+blind",true,  true},
+    };
+
+  memset(&opts,0,sizeof(opts));
+  opts.key = key_;
+
+  printf("key: %s\n",key_->name);
+
+  fast = 0;
+  for(size_t i = 0; i < (sizeof(modes) / sizeof(modes[0])); i++)
+    {
+      opts.constant_time = modes[i].ct;
+      opts.blind         = modes[i].blind;
+
+      rate = benchmark_mode(&opts);
+      if(i == 0)
+        fast = rate;
+
+      printf("  %-20s %10.0f sig/s",modes[i].name,rate);
+      if((i > 0) && (rate > 0))
+        printf("  (%.2fx the time of fast)",(fast / rate));
+      printf("\n");
+    }
+
+  printf("  modular squaring (ops/s): division %.0f, barrett %.0f, montgomery %.0f\n",
+         benchmark_reduce(key_,REDUCE_DIVIDE),
+         benchmark_reduce(key_,REDUCE_BARRETT),
+         benchmark_reduce(key_,REDUCE_MONTGOMERY));
+
+  return 0;
+}
+
+/*
+ * Writes a new key with CRT values to filepath_, or stdout when NULL,
+ * and loads it back so a bad key never leaves this function.
+ */
+static
+int
+genkey(unsigned    bits_,
+       const char *filepath_)
+{
+  int rv;
+  tdo_keyfile_t kf;
+  tdo_key_ctx_t ctx;
+
+  rv = tdo_keygen(&kf,bits_);
+  if(rv == 0)
+    rv = tdo_keyfile_save(filepath_,&kf);
+  tdo_keyfile_free(&kf);
+
+  if((rv == 0) && (filepath_ != NULL))
+    {
+      rv = tdo_key_ctx_init_file(&ctx,filepath_);
+      if(rv == 0)
+        tdo_key_ctx_free(&ctx);
+    }
+
+  return rv;
+}
+
+#define SELFTEST_COUNT 256
+
+typedef struct selftest_s selftest_t;
+struct selftest_s
+{
+  const tdo_aif_sign_opts_t *opts;
+  uint8_t                  (*sigs)[TDO_AIF_SIG_MAX_SIZE];
+  int                       *rv;
+};
+
+static
+void
+selftest_sign(void   *st_,
+              size_t  idx_)
+{
+  md5_ctx_t ctx;
+  md5_digest_t digest;
+  selftest_t *st = st_;
+
+  md5_init(&ctx);
+  md5_update(&ctx,&idx_,sizeof(idx_));
+  md5_finalize(&ctx,digest);
+
+  st->rv[idx_] = tdo_aif_sign_digest(st->opts,digest,st->sigs[idx_]);
+}
+
+static
+void
+selftest_done(void *st_)
+{
+  (void)st_;
+
+  tdo_aif_sign_release();
+}
+
+/*
+ * Signs the same digests on one thread and then on several and
+ * compares the results for every signing mode. Any shared state in
+ * the bignum or signing code shows up as a mismatch or a failure.
+ */
+static
+int
+selftest_signing(const tdo_key_ctx_t *key_)
+{
+  int rv;
+  size_t nthreads;
+  selftest_t serial;
+  selftest_t threaded;
+  tdo_aif_sign_opts_t opts;
+  static int rv_serial[SELFTEST_COUNT];
+  static int rv_threaded[SELFTEST_COUNT];
+  static uint8_t sigs_serial[SELFTEST_COUNT][TDO_AIF_SIG_MAX_SIZE];
+  static uint8_t sigs_threaded[SELFTEST_COUNT][TDO_AIF_SIG_MAX_SIZE];
+  static const struct { const char *name; bool ct; bool blind; } modes[] =
+    {
+     {"fast",               false, false},
+     {"constant-time",      true,  false},
+     {"blind",              false, true},
+     {"constant-time+blind",true,  true},
+    };
+
+  nthreads = parallel_ncpus();
+  if(nthreads < 4)
+    nthreads = 4;
+
+  memset(&opts,0,sizeof(opts));
+  opts.key = key_;
+
+  serial.opts   = &opts;
+  serial.sigs   = sigs_serial;
+  serial.rv     = rv_serial;
+  threaded.opts = &opts;
+  threaded.sigs = sigs_threaded;
+  threaded.rv   = rv_threaded;
+
+  printf("key: %s, %u signatures, %zu threads\n",key_->name,SELFTEST_COUNT,nthreads);
+
+  rv = 0;
+  for(size_t i = 0; i < (sizeof(modes) / sizeof(modes[0])); i++)
+    {
+      size_t bad;
+
+      opts.constant_time = modes[i].ct;
+      opts.blind         = modes[i].blind;
+
+      memset(sigs_serial,0,sizeof(sigs_serial));
+      memset(sigs_threaded,0,sizeof(sigs_threaded));
+
+      parallel_for(1,SELFTEST_COUNT,selftest_sign,NULL,&serial);
+      parallel_for(nthreads,SELFTEST_COUNT,selftest_sign,selftest_done,&threaded);
+
+      bad = 0;
+      for(size_t j = 0; j < SELFTEST_COUNT; j++)
+        {
+          if((rv_serial[j] < 0) ||
+             (rv_threaded[j] < 0) ||
+             memcmp(sigs_serial[j],sigs_threaded[j],key_->size))
+            bad++;
+        }
+
+      printf("  %-20s %s",modes[i].name,((bad == 0) ? "OK" : "FAILED"));
+      if(bad)
+        printf(" (%zu of %u differ)",bad,SELFTEST_COUNT);
+      printf("\n");
+
+      if(bad)
+        rv = -1;
+    }
+
+  return rv;
+}
+
+static
+void
+sign_opts_set(struct simple_opt   *options_,
+              tdo_aif_sign_opts_t *opts_)
+{
+  opts_->constant_time = option_seen(options_,"constant-time");
+  opts_->blind         = option_seen(options_,"blind");
+  opts_->cache         = NULL;
+}
+
+/* NULL without --sig-cache or if the cache can't be used */
+static
+tdo_sig_cache_t*
+sig_cache_open(struct simple_opt *options_)
+{
+  if(!option_seen(options_,"sig-cache"))
+    return NULL;
+
+  return tdo_sig_cache_open(option_find(options_,"sig-cache")->val.v_string);
+}
+
+static
+int
+sign_opts_init(struct simple_opt   *options_,
+               tdo_aif_sign_opts_t *opts_)
+{
+  sign_opts_set(options_,opts_);
+  if(sign_key(options_,&opts_->key) < 0)
+    return -1;
+
+  if(opts_->key != NULL)
+    opts_->cache = sig_cache_open(options_);
+
+  return 0;
+}
+
+#define BATCH_CHUNK 64
+
+/*
+ * Everything that decides what --batch writes: the modbin version, the
+ * signing key and each header option given with its value. Options
+ * which can't change the output bytes are left out so they don't
+ * invalidate the skip cache.
+ */
+static
+void
+batch_fingerprint(struct simple_opt   *options_,
+                  const tdo_key_ctx_t *key_,
+                  md5_digest_t         fingerprint_)
+{
+  md5_ctx_t ctx;
+  char value[32];
+  static const char *ignored[] =
+    {
+     "constant-time","blind","sig-cache","skip-cache",
+     "batch","sign","keyfile",NULL
+    };
+
+  md5_init(&ctx);
+  md5_update(&ctx,MODBIN_VERSION,sizeof(MODBIN_VERSION));
+  if(key_ != NULL)
+    md5_update(&ctx,key_->id,sizeof(key_->id));
+
+  for(int i = 0; options_[i].type != SIMPLE_OPT_END; i++)
+    {
+      bool skip;
+
+      if(!options_[i].was_seen || (options_[i].long_name == NULL))
+        continue;
+
+      skip = false;
+      for(int j = 0; ignored[j] != NULL; j++)
+        skip |= streq(options_[i].long_name,ignored[j]);
+      if(skip)
+        continue;
+
+      md5_update(&ctx,options_[i].long_name,strlen(options_[i].long_name) + 1);
+      switch(options_[i].type)
+        {
+        case SIMPLE_OPT_UNSIGNED:
+          snprintf(value,sizeof(value),"%lu",options_[i].val.v_unsigned);
+          md5_update(&ctx,value,strlen(value) + 1);
+          break;
+        case SIMPLE_OPT_STRING:
+          md5_update(&ctx,options_[i].val.v_string,strlen(options_[i].val.v_string) + 1);
+          break;
+        default:
+          break;
+        }
+    }
+
+  md5_finalize(&ctx,fingerprint_);
+}
+
+/*
+ * NULL without --skip-cache. --time stamps every file with the time
+ * of the run so nothing written with it can be skipped.
+ */
+static
+skip_cache_t*
+batch_skip_cache(struct simple_opt   *options_,
+                 const tdo_key_ctx_t *key_)
+{
+  md5_digest_t fingerprint;
+
+  if(!option_seen(options_,"skip-cache"))
+    return NULL;
+
+  if(option_seen(options_,"time"))
+    {
+      fprintf(stderr,"WARNING: --skip-cache has no effect with --time\n");
+      return NULL;
+    }
+
+  batch_fingerprint(options_,key_,fingerprint);
+
+  return skip_cache_open(option_find(options_,"skip-cache")->val.v_string,fingerprint);
+}
+
+/*
+ * Apply the header options to every input and sign them together so
+ * the key work can be shared across files. Files are rewritten in
+ * place and processed BATCH_CHUNK at a time to bound memory use.
+ * With --skip-cache files last written by a run with the same options
+ * and not touched since are left alone without being read.
+ */
+static
+int
+batch_files(struct simple_opt  *options_,
+            int                 argc_,
+            char              **argv_)
+{
+  int rv;
+  skip_cache_t *skip;
+  tdo_aif_sign_opts_t sign_opts;
+  tdo_aif_sign_item_t items[BATCH_CHUNK];
+
+  if(sign_opts_init(options_,&sign_opts) < 0)
+    return -1;
+
+  skip = batch_skip_cache(options_,sign_opts.key);
+
+  rv = 0;
+  for(int base = 0; base < argc_; base += BATCH_CHUNK)
+    {
+      int count;
+
+      count = 0;
+      for(int i = base; (i < argc_) && (i < (base + BATCH_CHUNK)); i++)
+        {
+          void *buf;
+          size_t size;
+
+          if(skip && skip_cache_unchanged(skip,argv_[i]))
+            continue;
+
+          buf = fileio_read_all(argv_[i],&size);
+          if(buf == NULL)
+            {
+              fprintf(stderr,"ERROR: unable to open file - %s\n",argv_[i]);
+              rv = -1;
+              continue;
+            }
+
+          if(!tdo_aif_is_aif(buf,size))
+            {
+              fprintf(stderr,"ERROR: does not appear to be a valid AIF file - %s\n",argv_[i]);
+              free(buf);
+              rv = -1;
+              continue;
+            }
+
+          apply_header_options(options_,buf,&size);
+
+          items[count].buf      = buf;
+          items[count].size     = size;
+          items[count].filepath = argv_[i];
+          items[count].rv       = 0;
+          count++;
+        }
+
+      if((sign_opts.key != NULL) && (tdo_aif_sign_batch(items,count,&sign_opts) < 0))
+        rv = -1;
+
+      for(int i = 0; i < count; i++)
+        {
+          if(items[i].rv == 0)
+            {
+              if(fileio_write_all(items[i].filepath,items[i].buf,items[i].size) < 0)
+                rv = -1;
+              else if(skip)
+                skip_cache_record(skip,items[i].filepath);
+            }
+          free(items[i].buf);
+        }
+    }
+
+  skip_cache_close(skip);
+  tdo_sig_cache_close(sign_opts.cache);
+
+  return rv;
+}
+
+/*
+ * --sign=app,3do: one input and an output per key in the same order.
+ * The input is read and hashed once for both signatures.
+ */
+static
+int
+sign_files_keys(struct simple_opt  *options_,
+                int                 argc_,
+                char              **argv_)
+{
+  int rv;
+  int nkeys;
+  void *buf;
+  size_t size;
+  tdo_aif_sign_opts_t sign_opts;
+  const tdo_key_ctx_t *keys[2];
+  tdo_aif_sign_item_t outs[2];
+
+  nkeys = sign_keys(options_,keys);
+  if(nkeys < 0)
+    return -1;
+
+  if(argc_ != (nkeys + 1))
+    {
+      fprintf(stderr,"ERROR: --sign with %d keys needs an input and %d outputs\n",nkeys,nkeys);
+      return -1;
+    }
+
+  buf = fileio_read_all(argv_[0],&size);
+  if(buf == NULL)
+    {
+      fprintf(stderr,"ERROR: unable to open file - %s\n",argv_[0]);
+      return -1;
+    }
+
+  if(!tdo_aif_is_aif(buf,size))
+    {
+      fprintf(stderr,"ERROR: does not appear to be a valid AIF file\n");
+      free(buf);
+      return -1;
+    }
+
+  memset(&sign_opts,0,sizeof(sign_opts));
+  sign_opts_set(options_,&sign_opts);
+  sign_opts.cache = sig_cache_open(options_);
+
+  apply_header_options(options_,buf,&size);
+
+  rv = tdo_aif_sign_keys(buf,size,&sign_opts,keys,outs,nkeys);
+  for(int i = 0; i < nkeys; i++)
+    {
+      if(outs[i].rv < 0)
+        continue;
+      if(i == 0)
+        tdo_aif_print(stdout,outs[i].buf);
+      if(fileio_write_all(argv_[i + 1],outs[i].buf,outs[i].size) < 0)
+        rv = -1;
+      free(outs[i].buf);
+    }
+
+  tdo_sig_cache_close(sign_opts.cache);
+  free(buf);
+
+  return rv;
+}
+
 int
 main(int    argc_,
      char **argv_)
@@ -69,7 +995,7 @@ main(int    argc_,
   int rv;
   void *file_buf;
   size_t file_size;
-  const char *sign;
+  tdo_aif_sign_opts_t sign_opts;
   const char *input_file;
   const char *output_file;
   struct simple_opt *options;
@@ -90,6 +1016,35 @@ main(int    argc_,
       exit(EXIT_SUCCESS);
     }
 
+  if(option_seen(options,"benchmark"))
+    {
+      rv = sign_key(options,&sign_opts.key);
+      if((rv == 0) && (sign_opts.key == NULL))
+        sign_opts.key = tdo_key_ctx_get("app");
+      if(sign_opts.key != NULL)
+        rv = benchmark_signing(sign_opts.key);
+      exit(((rv == 0) && (sign_opts.key != NULL)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  if(option_seen(options,"genkey"))
+    {
+      rv = genkey(option_find(options,"genkey")->val.v_unsigned,
+                  ((result.argc >= 1) ? result.argv[0] : NULL));
+      exit((rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  if(option_seen(options,"selftest"))
+    {
+      rv = sign_key(options,&sign_opts.key);
+      if((rv == 0) && (sign_opts.key == NULL))
+        sign_opts.key = tdo_key_ctx_get("app");
+      if(sign_opts.key != NULL)
+        rv = selftest_signing(sign_opts.key);
+      if(tdo_aif_kat() < 0)
+        rv = -1;
+      exit(((rv == 0) && (sign_opts.key != NULL)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
   if(options[0].was_seen || (result.argc < 1))
     {
       simple_opt_print_usage(stdout,
@@ -101,6 +1056,37 @@ main(int    argc_,
       exit(EXIT_SUCCESS);
     }
 
+  if(option_seen(options,"fingerprint"))
+    {
+      rv = fingerprint_files(result.argc,result.argv);
+      exit((rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  if(option_seen(options,"verify"))
+    {
+      size_t nkeys;
+      const tdo_key_ctx_t *keys[2];
+
+      nkeys = verify_keys(options,keys);
+      if(nkeys == 0)
+        exit(EXIT_FAILURE);
+
+      rv = verify_files(keys,nkeys,result.argc,result.argv);
+      exit((rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  if(option_seen(options,"batch"))
+    {
+      rv = batch_files(options,result.argc,result.argv);
+      exit((rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+  if(sign_key_count(options) > 1)
+    {
+      rv = sign_files_keys(options,result.argc,result.argv);
+      exit((rv == 0) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
   input_file  = result.argv[0];
   output_file = ((result.argc == 2) ? result.argv[1] : NULL);
 
@@ -117,49 +1103,15 @@ main(int    argc_,
       exit(EXIT_FAILURE);
     }
 
-  sign = NULL;
-  for(int i = 0; options[i].type != SIMPLE_OPT_END; i++)
-    {
-      if(!options[i].was_seen)
-        continue;
+  rv = sign_opts_init(options,&sign_opts);
+  if(rv < 0)
+    goto error;
 
-      if(streq(options[i].long_name,"debug"))
-        tdo_aif_set_debug(file_buf);
-      else if(streq(options[i].long_name,"nodebug"))
-        tdo_aif_set_nodebug(file_buf);
-      else if(streq(options[i].long_name,"subsystype"))
-        tdo_aif_set_subsystype(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"type"))
-        tdo_aif_set_type(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"pri"))
-        tdo_aif_set_priority(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"version"))
-        tdo_aif_set_version(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"flags"))
-        tdo_aif_set_flags(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"osversion"))
-        tdo_aif_set_osversion(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"osrevision"))
-        tdo_aif_set_osrevision(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"stack"))
-        tdo_aif_set_stack(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"freespace"))
-        tdo_aif_set_freespace(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"maxusecs"))
-        tdo_aif_set_maxusecs(file_buf,options[i].val.v_unsigned);
-      else if(streq(options[i].long_name,"name"))
-        tdo_aif_set_name(file_buf,options[i].val.v_string);
-      else if(streq(options[i].long_name,"time"))
-        tdo_aif_set_time(file_buf);
-      else if(streq(options[i].long_name,"reset"))
-        tdo_aif_reset(file_buf,&file_size);
-      else if(streq(options[i].long_name,"sign"))
-        sign = options[i].string_set[options[i].val.v_string_set_idx];
-    }
-
-  if(sign != NULL)
-    {
-      rv = tdo_aif_sign(&file_buf,&file_size,sign);
+  apply_header_options(options,file_buf,&file_size);
+
+  if(sign_opts.key != NULL)
+    {
+      rv = tdo_aif_sign(&file_buf,&file_size,&sign_opts);
       if(rv == -1)
         goto error;
     }
@@ -170,6 +1122,7 @@ main(int    argc_,
     rv = fileio_write_all(output_file,file_buf,file_size);
 
  error:
+  tdo_sig_cache_close(sign_opts.cache);
   free(file_buf);
 
   return ((rv == 0) ? 0 : 1);
@@ -234,6 +234,24 @@ md5_update(md5_ctx_t  *ctx_,
   memcpy(ctx_->buffer,data_,size_);
 }
 
+/*
+ * Feeds each segment in turn. Segments need not be 64-byte aligned or
+ * contiguous; partial blocks are carried across segment boundaries in
+ * the context buffer just as with consecutive md5_update() calls.
+ */
+void
+md5_update_iov(md5_ctx_t       *ctx_,
+               const md5_iov_t *iov_,
+               md5_size_t       iovcnt_)
+{
+  for(md5_size_t i = 0; i < iovcnt_; i++)
+    {
+      if(iov_[i].len == 0)
+        continue;
+      md5_update(ctx_,iov_[i].base,iov_[i].len);
+    }
+}
+
 static
 void
 copy_bytes_from_u32(md5_u8_t *dst_,
@@ -46,6 +46,14 @@ struct md5_ctx_s
   md5_u8_t  buffer[64];
 };
 
+typedef struct md5_iov_s md5_iov_t;
+struct md5_iov_s
+{
+  const void *base;
+  md5_size_t  len;
+};
+
 extern void md5_init(md5_ctx_t *ctx);
 extern void md5_update(md5_ctx_t *ctx, const void *data, md5_size_t size);
+extern void md5_update_iov(md5_ctx_t *ctx, const md5_iov_t *iov, md5_size_t iovcnt);
 extern void md5_finalize(md5_ctx_t *ctx, md5_digest_t digest);
@@ -0,0 +1,123 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "mpfw.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if MPFW_AVAILABLE
+
+typedef unsigned __int128 u128_t;
+
+#if defined(__clang__)
+#define MPFW_UNROLL _Pragma("clang loop unroll(full)")
+#elif defined(__GNUC__) && (__GNUC__ >= 8)
+#define MPFW_UNROLL _Pragma("GCC unroll 16")
+#else
+#define MPFW_UNROLL
+#endif
+
+int
+mpfw_sched_init(mpfw_sched_t   *sched_,
+                const uint64_t *e_,
+                size_t          elimbs_)
+{
+  size_t i;
+  size_t sqr;
+  size_t nbits;
+  size_t winlen;
+
+#define EBIT(k) ((e_[(k) / 64] >> ((k) % 64)) & 1)
+
+  nbits = (elimbs_ * 64);
+  while((nbits > 0) && !EBIT(nbits - 1))
+    nbits--;
+
+  if(nbits > MPFW_SCHED_MAXBITS)
+    return -1;
+
+  winlen = ((nbits > 240) ? 5 : (nbits > 64) ? 4 : (nbits > 16) ? 3 : 1);
+  if(winlen > MPFW_MAXWINLEN)
+    winlen = MPFW_MAXWINLEN;
+
+  sched_->winlen = winlen;
+  sched_->nops   = 0;
+
+  sqr = 0;
+  i   = nbits;
+  while(i > 0)
+    {
+      size_t l;
+      uint64_t val;
+
+      if(!EBIT(i - 1))
+        {
+          sqr++;
+          i--;
+          continue;
+        }
+
+      l = ((i > winlen) ? (i - winlen) : 0);
+      while(!EBIT(l))
+        l++;
+      val = 0;
+      for(size_t j = i; j > l; j--)
+        val = ((val << 1) | EBIT(j - 1));
+
+      sched_->ops[sched_->nops].sqr = ((sched_->nops == 0) ? 0 : (sqr + (i - l)));
+      sched_->ops[sched_->nops].idx = (val >> 1);
+      sched_->nops++;
+
+      sqr = 0;
+      i   = l;
+    }
+
+#undef EBIT
+
+  sched_->tail = sqr;
+
+  return 0;
+}
+
+#define MPFW_CT_WINLEN 4
+
+/* all ones when a == b, zero otherwise, without a branch */
+static
+inline
+uint64_t
+mpfw_ct_eq(uint64_t a_,
+           uint64_t b_)
+{
+  uint64_t d;
+
+  d = (a_ ^ b_);
+
+  return ((((d | (0 - d)) >> 63) & 1) - 1);
+}
+
+#define MPFW_BITS 256
+#include "mpfw_tmpl.h"
+#undef MPFW_BITS
+
+#define MPFW_BITS 512
+#include "mpfw_tmpl.h"
+#undef MPFW_BITS
+
+#endif
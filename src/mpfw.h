@@ -0,0 +1,131 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Fixed width Montgomery arithmetic on 64-bit limbs for the 256 and
+ * 512 bit sizes used by 3DO RSA-512 signing (and its CRT halves).
+ * Limb arrays are little-endian. Requires unsigned __int128; when the
+ * compiler lacks it MPFW_AVAILABLE is 0 and callers must use bigd.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__SIZEOF_INT128__)
+#define MPFW_AVAILABLE 1
+#else
+#define MPFW_AVAILABLE 0
+#endif
+
+#define MPFW256_LIMBS 4
+#define MPFW512_LIMBS 8
+
+#define MPFW_MAXWINLEN      5
+#define MPFW_SCHED_MAXBITS  512
+
+/*
+ * Left to right sliding window decomposition of an exponent. Each op
+ * squares the accumulator sqr times and then multiplies by the odd
+ * power table entry idx (x^(2*idx+1)); the first op just loads its
+ * entry. tail squarings follow the last op. An exponent of zero has
+ * no ops.
+ */
+typedef struct mpfw_sched_op_s mpfw_sched_op_t;
+struct mpfw_sched_op_s
+{
+  uint16_t sqr;
+  uint16_t idx;
+};
+
+typedef struct mpfw_sched_s mpfw_sched_t;
+struct mpfw_sched_s
+{
+  uint16_t        winlen;
+  uint16_t        nops;
+  uint16_t        tail;
+  mpfw_sched_op_t ops[MPFW_SCHED_MAXBITS];
+};
+
+int mpfw_sched_init(mpfw_sched_t   *sched,
+                    const uint64_t *e,
+                    size_t          elimbs);
+
+#define MPFW_DECLARE(BITS)                                              \
+  typedef struct mpfw##BITS##_mont_s mpfw##BITS##_mont_t;               \
+  struct mpfw##BITS##_mont_s                                            \
+  {                                                                     \
+    uint64_t n[MPFW##BITS##_LIMBS];                                     \
+    uint64_t r2[MPFW##BITS##_LIMBS];                                    \
+    uint64_t ninv;                                                      \
+  };                                                                    \
+                                                                        \
+  void mpfw##BITS##_from_octets(uint64_t r[MPFW##BITS##_LIMBS],         \
+                                const uint8_t *octets,                  \
+                                size_t len);                            \
+  void mpfw##BITS##_to_octets(const uint64_t a[MPFW##BITS##_LIMBS],     \
+                              uint8_t *octets,                          \
+                              size_t len);                              \
+  void mpfw##BITS##_mul(uint64_t r[2*MPFW##BITS##_LIMBS],               \
+                        const uint64_t a[MPFW##BITS##_LIMBS],           \
+                        const uint64_t b[MPFW##BITS##_LIMBS]);          \
+  void mpfw##BITS##_mul_add(uint64_t r[2*MPFW##BITS##_LIMBS],           \
+                            const uint64_t a[MPFW##BITS##_LIMBS],       \
+                            const uint64_t b[MPFW##BITS##_LIMBS],       \
+                            const uint64_t c[MPFW##BITS##_LIMBS]);      \
+  void mpfw##BITS##_sqr(uint64_t r[2*MPFW##BITS##_LIMBS],               \
+                        const uint64_t a[MPFW##BITS##_LIMBS]);          \
+  int  mpfw##BITS##_mont_init(mpfw##BITS##_mont_t *ctx,                 \
+                              const uint64_t n[MPFW##BITS##_LIMBS]);    \
+  void mpfw##BITS##_mont_redc(uint64_t r[MPFW##BITS##_LIMBS],           \
+                              uint64_t t[2*MPFW##BITS##_LIMBS],         \
+                              const mpfw##BITS##_mont_t *ctx);          \
+  void mpfw##BITS##_mont_mul(uint64_t r[MPFW##BITS##_LIMBS],            \
+                             const uint64_t a[MPFW##BITS##_LIMBS],      \
+                             const uint64_t b[MPFW##BITS##_LIMBS],      \
+                             const mpfw##BITS##_mont_t *ctx);           \
+  void mpfw##BITS##_mont_sqr(uint64_t r[MPFW##BITS##_LIMBS],            \
+                             const uint64_t a[MPFW##BITS##_LIMBS],      \
+                             const mpfw##BITS##_mont_t *ctx);           \
+  void mpfw##BITS##_mod_sub(uint64_t r[MPFW##BITS##_LIMBS],             \
+                            const uint64_t a[MPFW##BITS##_LIMBS],       \
+                            const uint64_t b[MPFW##BITS##_LIMBS],       \
+                            const mpfw##BITS##_mont_t *ctx);            \
+  void mpfw##BITS##_mod_wide(uint64_t r[MPFW##BITS##_LIMBS],            \
+                             const uint64_t t[2*MPFW##BITS##_LIMBS],    \
+                             const mpfw##BITS##_mont_t *ctx);           \
+  void mpfw##BITS##_modexp(uint64_t r[MPFW##BITS##_LIMBS],              \
+                           const uint64_t x[MPFW##BITS##_LIMBS],        \
+                           const uint64_t *e,                           \
+                           size_t elimbs,                               \
+                           const mpfw##BITS##_mont_t *ctx);             \
+  void mpfw##BITS##_modexp_sched(uint64_t r[MPFW##BITS##_LIMBS],        \
+                                 const uint64_t x[MPFW##BITS##_LIMBS],  \
+                                 const mpfw_sched_t *sched,             \
+                                 const mpfw##BITS##_mont_t *ctx);       \
+  void mpfw##BITS##_modexp_ct(uint64_t r[MPFW##BITS##_LIMBS],           \
+                              const uint64_t x[MPFW##BITS##_LIMBS],     \
+                              const uint64_t *e,                        \
+                              size_t elimbs,                            \
+                              const mpfw##BITS##_mont_t *ctx)
+
+#if MPFW_AVAILABLE
+MPFW_DECLARE(256);
+MPFW_DECLARE(512);
+#endif
@@ -0,0 +1,392 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "mpfw4.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if MPFW_AVAILABLE
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MPFW4_X86 1
+#include <immintrin.h>
+#else
+#define MPFW4_X86 0
+#endif
+
+#if defined(__clang__)
+#define MPFW4_UNROLL _Pragma("clang loop unroll(full)")
+#elif defined(__GNUC__) && (__GNUC__ >= 8)
+#define MPFW4_UNROLL _Pragma("GCC unroll 20")
+#else
+#define MPFW4_UNROLL
+#endif
+
+/*
+ * Radix 2^26 limbs in four 64-bit AVX2 lanes, one message per lane.
+ * vpmuludq is exactly the 32x32->64 lane multiply needed. Values are
+ * kept in [0, 2n) between operations: R = 2^260 > 4n so the
+ * Montgomery product of two such values stays below 2n without a
+ * final subtraction, and 64-bit accumulators have room for the ~20
+ * unreduced 52-bit products each column collects.
+ */
+
+#if MPFW4_X86
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+#define VEC_T            __m256i
+#define V_SET1(x)        _mm256_set1_epi64x((long long)(x))
+#define V_ADD(a,b)       _mm256_add_epi64(a,b)
+#define V_AND(a,b)       _mm256_and_si256(a,b)
+#define V_MUL(a,b)       _mm256_mul_epu32(a,b)
+#define V_SRL(a,n)       _mm256_srli_epi64(a,n)
+#define V_LOAD4(a,b,c,d) _mm256_set_epi64x((long long)(d),(long long)(c),(long long)(b),(long long)(a))
+#define V_STORE(p,v)     _mm256_storeu_si256((__m256i*)(p),v)
+
+static
+void
+limbs26_from64(uint64_t       r_[MPFW4_LIMBS],
+               const uint64_t x_[MPFW256_LIMBS])
+{
+  for(size_t k = 0; k < MPFW4_LIMBS; k++)
+    {
+      size_t bit = (k * 26);
+      size_t w   = (bit / 64);
+      size_t s   = (bit % 64);
+      uint64_t v;
+
+      v = (x_[w] >> s);
+      if((s > (64 - 26)) && ((w + 1) < MPFW256_LIMBS))
+        v |= (x_[w + 1] << (64 - s));
+      r_[k] = (v & ((1ULL << 26) - 1));
+    }
+}
+
+static
+void
+limbs26_to64(uint64_t       r_[MPFW256_LIMBS],
+             const uint64_t x_[MPFW4_LIMBS])
+{
+  memset(r_,0,(MPFW256_LIMBS * sizeof(uint64_t)));
+  for(size_t k = 0; k < MPFW4_LIMBS; k++)
+    {
+      size_t bit = (k * 26);
+      size_t w   = (bit / 64);
+      size_t s   = (bit % 64);
+
+      r_[w] |= (x_[k] << s);
+      if((s > (64 - 26)) && ((w + 1) < MPFW256_LIMBS))
+        r_[w + 1] |= (x_[k] >> (64 - s));
+    }
+}
+
+#define M26 ((1ULL << 26) - 1)
+#define N   MPFW4_LIMBS
+
+static
+void
+avx2_mont_mul(VEC_T                   r_[N],
+             const VEC_T             a_[N],
+             const VEC_T             b_[N],
+             const VEC_T             n_[N],
+             const VEC_T             ninv_)
+{
+  VEC_T u;
+  VEC_T mask;
+  VEC_T t[2 * N];
+
+  mask = V_SET1(M26);
+  MPFW4_UNROLL
+  for(size_t k = 0; k < (2 * N); k++)
+    t[k] = V_SET1(0);
+
+  MPFW4_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      MPFW4_UNROLL
+      for(size_t j = 0; j < N; j++)
+        t[i + j] = V_ADD(t[i + j],V_MUL(a_[i],b_[j]));
+
+      u = V_AND(V_MUL(t[i],ninv_),mask);
+      MPFW4_UNROLL
+      for(size_t j = 0; j < N; j++)
+        t[i + j] = V_ADD(t[i + j],V_MUL(u,n_[j]));
+
+      t[i + 1] = V_ADD(t[i + 1],V_SRL(t[i],26));
+    }
+
+  MPFW4_UNROLL
+  for(size_t k = N; k < ((2 * N) - 1); k++)
+    {
+      t[k + 1] = V_ADD(t[k + 1],V_SRL(t[k],26));
+      r_[k - N] = V_AND(t[k],mask);
+    }
+  r_[N - 1] = t[(2 * N) - 1];
+}
+
+/* a^2: cross products use 2*a[j] so each pair is multiplied once */
+static
+void
+avx2_mont_sqr(VEC_T       r_[N],
+             const VEC_T a_[N],
+             const VEC_T n_[N],
+             const VEC_T ninv_)
+{
+  VEC_T u;
+  VEC_T mask;
+  VEC_T a2[N];
+  VEC_T t[2 * N];
+
+  mask = V_SET1(M26);
+  MPFW4_UNROLL
+  for(size_t k = 0; k < (2 * N); k++)
+    t[k] = V_SET1(0);
+  MPFW4_UNROLL
+  for(size_t j = 0; j < N; j++)
+    a2[j] = V_ADD(a_[j],a_[j]);
+
+  MPFW4_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      t[2 * i] = V_ADD(t[2 * i],V_MUL(a_[i],a_[i]));
+      MPFW4_UNROLL
+      for(size_t j = i + 1; j < N; j++)
+        t[i + j] = V_ADD(t[i + j],V_MUL(a_[i],a2[j]));
+
+      u = V_AND(V_MUL(t[i],ninv_),mask);
+      MPFW4_UNROLL
+      for(size_t j = 0; j < N; j++)
+        t[i + j] = V_ADD(t[i + j],V_MUL(u,n_[j]));
+
+      t[i + 1] = V_ADD(t[i + 1],V_SRL(t[i],26));
+    }
+
+  MPFW4_UNROLL
+  for(size_t k = N; k < ((2 * N) - 1); k++)
+    {
+      t[k + 1] = V_ADD(t[k + 1],V_SRL(t[k],26));
+      r_[k - N] = V_AND(t[k],mask);
+    }
+  r_[N - 1] = t[(2 * N) - 1];
+}
+
+static
+void
+avx2_pack(VEC_T          r_[N],
+         const uint64_t x_[MPFW4_LANES][MPFW256_LIMBS])
+{
+  uint64_t l[MPFW4_LANES][N];
+
+  for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+    limbs26_from64(l[lane],x_[lane]);
+
+  for(size_t k = 0; k < N; k++)
+    r_[k] = V_LOAD4(l[0][k],l[1][k],l[2][k],l[3][k]);
+}
+
+static
+void
+avx2_unpack(uint64_t    r_[MPFW4_LANES][MPFW256_LIMBS],
+           const VEC_T x_[N])
+{
+  uint64_t v[MPFW4_LANES];
+  uint64_t l[MPFW4_LANES][N];
+
+  for(size_t k = 0; k < N; k++)
+    {
+      V_STORE(v,x_[k]);
+      for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+        l[lane][k] = v[lane];
+    }
+
+  for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+    limbs26_to64(r_[lane],l[lane]);
+}
+
+static
+void
+avx2_modexp_sched(uint64_t                r_[MPFW4_LANES][MPFW256_LIMBS],
+                  const uint64_t          x_[MPFW4_LANES][MPFW256_LIMBS],
+                  const mpfw_sched_t     *sched_,
+                  const mpfw4_256_mont_t *ctx_)
+{
+  VEC_T ninv;
+  VEC_T n[N];
+  VEC_T t[N];
+  VEC_T a[N];
+  VEC_T g2[N];
+  VEC_T tbl[1 << (MPFW_MAXWINLEN - 1)][N];
+
+  if(sched_->nops == 0)
+    {
+      for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+        {
+          memset(r_[lane],0,sizeof(r_[lane]));
+          r_[lane][0] = 1;
+        }
+      return;
+    }
+
+  ninv = V_SET1(ctx_->ninv);
+  for(size_t k = 0; k < N; k++)
+    {
+      n[k] = V_SET1(ctx_->n[k]);
+      g2[k] = V_SET1(ctx_->rr[k]);
+    }
+
+  avx2_pack(t,x_);
+  avx2_mont_mul(tbl[0],t,g2,n,ninv);
+
+  if(sched_->winlen > 1)
+    {
+      avx2_mont_sqr(g2,tbl[0],n,ninv);
+      for(size_t k = 1; k < ((size_t)1 << (sched_->winlen - 1)); k++)
+        avx2_mont_mul(tbl[k],tbl[k - 1],g2,n,ninv);
+    }
+
+  memcpy(a,tbl[sched_->ops[0].idx],sizeof(a));
+  for(size_t k = 1; k < sched_->nops; k++)
+    {
+      for(size_t j = 0; j < sched_->ops[k].sqr; j++)
+        avx2_mont_sqr(a,a,n,ninv);
+      avx2_mont_mul(a,a,tbl[sched_->ops[k].idx],n,ninv);
+    }
+  for(size_t j = 0; j < sched_->tail; j++)
+    avx2_mont_sqr(a,a,n,ninv);
+
+  for(size_t k = 0; k < N; k++)
+    t[k] = V_SET1(k == 0);
+  avx2_mont_mul(a,a,t,n,ninv);
+  avx2_unpack(r_,a);
+
+  for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+    mpfw256_mod_sub(r_[lane],r_[lane],ctx_->mont.n,&ctx_->mont);
+}
+
+#undef N
+#undef M26
+
+#undef V_STORE
+#undef V_LOAD4
+#undef V_SRL
+#undef V_MUL
+#undef V_AND
+#undef V_ADD
+#undef V_SET1
+#undef VEC_T
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+/*
+ * Not cached: the answer is kept in each mpfw4_256_mont_t, which is
+ * set up before signing threads start and only read after.
+ */
+static
+int
+have_avx2(void)
+{
+  __builtin_cpu_init();
+
+  return !!__builtin_cpu_supports("avx2");
+}
+#else
+static
+int
+have_avx2(void)
+{
+  return 0;
+}
+#endif
+
+void
+mpfw4_256_mont_init(mpfw4_256_mont_t     *ctx_,
+                    const mpfw256_mont_t *mont_)
+{
+  uint64_t t[2 * MPFW256_LIMBS];
+  uint64_t rr[MPFW256_LIMBS];
+  const uint64_t k256[MPFW256_LIMBS] = {256};
+
+  memset(ctx_,0,sizeof(*ctx_));
+  ctx_->mont = *mont_;
+
+#if MPFW4_X86
+  ctx_->avx2 = have_avx2();
+  ctx_->ninv = (mont_->ninv & ((1ULL << 26) - 1));
+  limbs26_from64(ctx_->n,mont_->n);
+
+  /* (2^260)^2 mod n = (2^256)^2 * 2^8 mod n */
+  mpfw256_mul(t,mont_->r2,k256);
+  mpfw256_mod_wide(rr,t,mont_);
+  limbs26_from64(ctx_->rr,rr);
+#else
+  (void)t;
+  (void)rr;
+  (void)k256;
+#endif
+}
+
+void
+mpfw4_256_modexp_sched(uint64_t                r_[MPFW4_LANES][MPFW256_LIMBS],
+                       const uint64_t          x_[MPFW4_LANES][MPFW256_LIMBS],
+                       const mpfw_sched_t     *sched_,
+                       const mpfw4_256_mont_t *ctx_)
+{
+#if MPFW4_X86
+  if(ctx_->avx2)
+    {
+      avx2_modexp_sched(r_,x_,sched_,ctx_);
+      return;
+    }
+#endif
+
+  for(size_t lane = 0; lane < MPFW4_LANES; lane++)
+    mpfw256_modexp_sched(r_[lane],x_[lane],sched_,&ctx_->mont);
+}
+
+void
+mpfw4_256_modexp(uint64_t                r_[MPFW4_LANES][MPFW256_LIMBS],
+                 const uint64_t          x_[MPFW4_LANES][MPFW256_LIMBS],
+                 const uint64_t         *e_,
+                 size_t                  elimbs_,
+                 const mpfw4_256_mont_t *ctx_)
+{
+  mpfw_sched_t sched;
+
+  mpfw_sched_init(&sched,e_,elimbs_);
+  mpfw4_256_modexp_sched(r_,x_,&sched,ctx_);
+}
+
+const
+char*
+mpfw4_impl(void)
+{
+  return (have_avx2() ? "avx2" : "scalar");
+}
+
+#endif
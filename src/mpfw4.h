@@ -0,0 +1,59 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Four independent 256-bit Montgomery exponentiations sharing one
+ * modulus and exponent, run lane-parallel on radix 2^26 limbs when
+ * the CPU has AVX2. Otherwise each lane goes through the scalar
+ * mpfw256 kernel, which beats a non-SIMD lane-interleaved version.
+ */
+
+#pragma once
+
+#include "mpfw.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MPFW4_LANES 4
+#define MPFW4_LIMBS 10
+
+#if MPFW_AVAILABLE
+typedef struct mpfw4_256_mont_s mpfw4_256_mont_t;
+struct mpfw4_256_mont_s
+{
+  mpfw256_mont_t mont;
+  uint64_t       n[MPFW4_LIMBS];
+  uint64_t       rr[MPFW4_LIMBS];
+  uint64_t       ninv;
+  int            avx2;
+};
+
+void mpfw4_256_mont_init(mpfw4_256_mont_t     *ctx,
+                         const mpfw256_mont_t *mont);
+void mpfw4_256_modexp(uint64_t               r[MPFW4_LANES][MPFW256_LIMBS],
+                      const uint64_t         x[MPFW4_LANES][MPFW256_LIMBS],
+                      const uint64_t        *e,
+                      size_t                 elimbs,
+                      const mpfw4_256_mont_t *ctx);
+void mpfw4_256_modexp_sched(uint64_t               r[MPFW4_LANES][MPFW256_LIMBS],
+                            const uint64_t         x[MPFW4_LANES][MPFW256_LIMBS],
+                            const mpfw_sched_t    *sched,
+                            const mpfw4_256_mont_t *ctx);
+const char *mpfw4_impl(void);
+#endif
@@ -0,0 +1,469 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Instantiated by mpfw.c once per size with MPFW_BITS defined. Every
+ * loop bound is a compile time constant and marked for full
+ * unrolling so each size gets straight-line kernels.
+ */
+
+#define MPFW_CAT_(a,b,c) a##b##_##c
+#define MPFW_CAT(a,b,c)  MPFW_CAT_(a,b,c)
+#define FN(name)         MPFW_CAT(mpfw,MPFW_BITS,name)
+#define CTX_T            MPFW_CAT(mpfw,MPFW_BITS,mont_t)
+#define N                (MPFW_BITS / 64)
+
+void
+FN(from_octets)(uint64_t       r_[N],
+                const uint8_t *octets_,
+                size_t         len_)
+{
+  for(size_t i = 0; i < N; i++)
+    r_[i] = 0;
+
+  for(size_t i = 0; (i < len_) && (i < (N * 8)); i++)
+    r_[i / 8] |= ((uint64_t)octets_[len_ - 1 - i] << ((i % 8) * 8));
+}
+
+void
+FN(to_octets)(const uint64_t  a_[N],
+              uint8_t        *octets_,
+              size_t          len_)
+{
+  for(size_t i = 0; i < len_; i++)
+    octets_[len_ - 1 - i] = ((i < (N * 8)) ? (uint8_t)(a_[i / 8] >> ((i % 8) * 8)) : 0);
+}
+
+static
+int
+FN(cmp)(const uint64_t a_[N],
+        const uint64_t b_[N])
+{
+  for(size_t i = N; i-- > 0;)
+    {
+      if(a_[i] != b_[i])
+        return ((a_[i] > b_[i]) ? 1 : -1);
+    }
+
+  return 0;
+}
+
+static
+uint64_t
+FN(sub)(uint64_t       r_[N],
+        const uint64_t a_[N],
+        const uint64_t b_[N])
+{
+  uint64_t borrow;
+
+  borrow = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      u128_t d;
+
+      d       = ((u128_t)a_[i] - b_[i] - borrow);
+      r_[i]   = (uint64_t)d;
+      borrow  = ((uint64_t)(d >> 64) & 1);
+    }
+
+  return borrow;
+}
+
+/*
+ * r = a - n if hi:a >= n else a, where hi is 0 or 1. Both are computed
+ * and the result picked with a mask so the choice doesn't branch.
+ */
+static
+void
+FN(select_sub)(uint64_t       r_[N],
+               const uint64_t a_[N],
+               uint64_t       hi_,
+               const uint64_t n_[N])
+{
+  uint64_t d[N];
+  uint64_t mask;
+
+  mask = (0 - (hi_ | (FN(sub)(d,a_,n_) ^ 1)));
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    r_[i] = ((d[i] & mask) | (a_[i] & ~mask));
+}
+
+void
+FN(mul)(uint64_t       r_[2*N],
+        const uint64_t a_[N],
+        const uint64_t b_[N])
+{
+  MPFW_UNROLL
+  for(size_t i = 0; i < (2 * N); i++)
+    r_[i] = 0;
+
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      uint64_t c;
+
+      c = 0;
+      MPFW_UNROLL
+      for(size_t j = 0; j < N; j++)
+        {
+          u128_t p;
+
+          p = ((u128_t)a_[j] * b_[i] + r_[i + j] + c);
+          r_[i + j] = (uint64_t)p;
+          c = (uint64_t)(p >> 64);
+        }
+      r_[i + N] = c;
+    }
+}
+
+/* r = a * b + c */
+void
+FN(mul_add)(uint64_t       r_[2*N],
+            const uint64_t a_[N],
+            const uint64_t b_[N],
+            const uint64_t c_[N])
+{
+  u128_t s;
+
+  FN(mul)(r_,a_,b_);
+
+  s = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < (2 * N); i++)
+    {
+      s     = ((u128_t)r_[i] + ((i < N) ? c_[i] : 0) + (uint64_t)(s >> 64));
+      r_[i] = (uint64_t)s;
+    }
+}
+
+/*
+ * Cross products a[i]*a[j], i < j, are accumulated once and doubled,
+ * then the squares of the individual limbs are added on the diagonal.
+ */
+void
+FN(sqr)(uint64_t       r_[2*N],
+        const uint64_t a_[N])
+{
+  uint64_t c;
+
+  MPFW_UNROLL
+  for(size_t i = 0; i < (2 * N); i++)
+    r_[i] = 0;
+
+  MPFW_UNROLL
+  for(size_t i = 0; i < (N - 1); i++)
+    {
+      c = 0;
+      MPFW_UNROLL
+      for(size_t j = i + 1; j < N; j++)
+        {
+          u128_t p;
+
+          p = ((u128_t)a_[i] * a_[j] + r_[i + j] + c);
+          r_[i + j] = (uint64_t)p;
+          c = (uint64_t)(p >> 64);
+        }
+      r_[i + N] = c;
+    }
+
+  c = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < (2 * N); i++)
+    {
+      uint64_t t;
+
+      t     = r_[i];
+      r_[i] = ((t << 1) | c);
+      c     = (t >> 63);
+    }
+
+  c = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      u128_t p;
+
+      p = ((u128_t)a_[i] * a_[i] + r_[2 * i] + c);
+      r_[2 * i] = (uint64_t)p;
+      p = ((u128_t)r_[2 * i + 1] + (uint64_t)(p >> 64));
+      r_[2 * i + 1] = (uint64_t)p;
+      c = (uint64_t)(p >> 64);
+    }
+}
+
+/* r = t * R^-1 mod n for t < n * R. t is destroyed. */
+void
+FN(mont_redc)(uint64_t     r_[N],
+              uint64_t     t_[2*N],
+              const CTX_T *ctx_)
+{
+  uint64_t top;
+
+  top = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      uint64_t u;
+      uint64_t c;
+      u128_t s;
+
+      u = (t_[i] * ctx_->ninv);
+      c = 0;
+      MPFW_UNROLL
+      for(size_t j = 0; j < N; j++)
+        {
+          u128_t p;
+
+          p = ((u128_t)u * ctx_->n[j] + t_[i + j] + c);
+          t_[i + j] = (uint64_t)p;
+          c = (uint64_t)(p >> 64);
+        }
+
+      s = ((u128_t)t_[i + N] + c + top);
+      t_[i + N] = (uint64_t)s;
+      top = (uint64_t)(s >> 64);
+    }
+
+  FN(select_sub)(r_,&t_[N],top,ctx_->n);
+}
+
+void
+FN(mont_mul)(uint64_t       r_[N],
+             const uint64_t a_[N],
+             const uint64_t b_[N],
+             const CTX_T   *ctx_)
+{
+  uint64_t t[2 * N];
+
+  FN(mul)(t,a_,b_);
+  FN(mont_redc)(r_,t,ctx_);
+}
+
+void
+FN(mont_sqr)(uint64_t       r_[N],
+             const uint64_t a_[N],
+             const CTX_T   *ctx_)
+{
+  uint64_t t[2 * N];
+
+  FN(sqr)(t,a_);
+  FN(mont_redc)(r_,t,ctx_);
+}
+
+/* r = a - b mod n for a, b < n */
+void
+FN(mod_sub)(uint64_t       r_[N],
+            const uint64_t a_[N],
+            const uint64_t b_[N],
+            const CTX_T   *ctx_)
+{
+  u128_t s;
+  uint64_t mask;
+
+  mask = (0 - FN(sub)(r_,a_,b_));
+
+  s = 0;
+  MPFW_UNROLL
+  for(size_t i = 0; i < N; i++)
+    {
+      s     = ((u128_t)r_[i] + (ctx_->n[i] & mask) + (uint64_t)(s >> 64));
+      r_[i] = (uint64_t)s;
+    }
+}
+
+/* r = t mod n for any t < n * R */
+void
+FN(mod_wide)(uint64_t       r_[N],
+             const uint64_t t_[2*N],
+             const CTX_T   *ctx_)
+{
+  uint64_t t[2 * N];
+
+  memcpy(t,t_,sizeof(t));
+  FN(mont_redc)(r_,t,ctx_);
+  FN(mont_mul)(r_,r_,ctx_->r2,ctx_);
+}
+
+/*
+ * n must be odd and use the full width (top bit set). R^2 mod n is
+ * built by doubling R mod n until it has been multiplied by R again.
+ */
+int
+FN(mont_init)(CTX_T          *ctx_,
+              const uint64_t  n_[N])
+{
+  uint64_t inv;
+  uint64_t r[N];
+
+  if(((n_[0] & 1) == 0) || ((n_[N - 1] >> 63) == 0))
+    return -1;
+
+  memcpy(ctx_->n,n_,sizeof(ctx_->n));
+
+  inv = n_[0];
+  for(int i = 0; i < 5; i++)
+    inv *= (2 - (n_[0] * inv));
+  ctx_->ninv = (0 - inv);
+
+  /* R mod n = R - n since R/2 <= n < R */
+  for(size_t i = 0; i < N; i++)
+    r[i] = 0;
+  FN(sub)(r,r,n_);
+
+  for(size_t i = 0; i < (64 * N); i++)
+    {
+      uint64_t c;
+
+      c = 0;
+      for(size_t j = 0; j < N; j++)
+        {
+          uint64_t t;
+
+          t    = r[j];
+          r[j] = ((t << 1) | c);
+          c    = (t >> 63);
+        }
+      if(c || (FN(cmp)(r,n_) >= 0))
+        FN(sub)(r,r,n_);
+    }
+
+  memcpy(ctx_->r2,r,sizeof(ctx_->r2));
+
+  return 0;
+}
+
+/* Runs a precomputed window schedule in the Montgomery domain. x < n. */
+void
+FN(modexp_sched)(uint64_t            r_[N],
+                 const uint64_t      x_[N],
+                 const mpfw_sched_t *sched_,
+                 const CTX_T        *ctx_)
+{
+  uint64_t a[N];
+  uint64_t g2[N];
+  uint64_t tbl[1 << (MPFW_MAXWINLEN - 1)][N];
+
+  if(sched_->nops == 0)
+    {
+      memset(r_,0,(N * sizeof(uint64_t)));
+      r_[0] = 1;
+      return;
+    }
+
+  FN(mont_mul)(tbl[0],x_,ctx_->r2,ctx_);
+  if(sched_->winlen > 1)
+    {
+      FN(mont_sqr)(g2,tbl[0],ctx_);
+      for(size_t k = 1; k < ((size_t)1 << (sched_->winlen - 1)); k++)
+        FN(mont_mul)(tbl[k],tbl[k - 1],g2,ctx_);
+    }
+
+  memcpy(a,tbl[sched_->ops[0].idx],sizeof(a));
+  for(size_t k = 1; k < sched_->nops; k++)
+    {
+      for(size_t j = 0; j < sched_->ops[k].sqr; j++)
+        FN(mont_sqr)(a,a,ctx_);
+      FN(mont_mul)(a,a,tbl[sched_->ops[k].idx],ctx_);
+    }
+  for(size_t j = 0; j < sched_->tail; j++)
+    FN(mont_sqr)(a,a,ctx_);
+
+  memset(g2,0,sizeof(g2));
+  g2[0] = 1;
+  FN(mont_mul)(r_,a,g2,ctx_);
+}
+
+/* Same for exponents without a cached schedule. e < 2^MPFW_SCHED_MAXBITS. */
+void
+FN(modexp)(uint64_t        r_[N],
+           const uint64_t  x_[N],
+           const uint64_t *e_,
+           size_t          elimbs_,
+           const CTX_T    *ctx_)
+{
+  mpfw_sched_t sched;
+
+  mpfw_sched_init(&sched,e_,elimbs_);
+  FN(modexp_sched)(r_,x_,&sched,ctx_);
+}
+
+/*
+ * Fixed 4-bit windows over all elimbs * 64 bits of e. Every window
+ * costs the same four squarings and one multiply and every table
+ * lookup reads all entries, so neither timing nor memory access
+ * depends on the exponent. x < n.
+ */
+void
+FN(modexp_ct)(uint64_t        r_[N],
+              const uint64_t  x_[N],
+              const uint64_t *e_,
+              size_t          elimbs_,
+              const CTX_T    *ctx_)
+{
+  uint64_t a[N];
+  uint64_t t[N];
+  uint64_t one[N];
+  uint64_t tbl[1 << MPFW_CT_WINLEN][N];
+
+  memset(one,0,sizeof(one));
+  one[0] = 1;
+
+  FN(mont_mul)(tbl[0],one,ctx_->r2,ctx_);
+  FN(mont_mul)(tbl[1],x_,ctx_->r2,ctx_);
+  for(size_t k = 2; k < (1 << MPFW_CT_WINLEN); k++)
+    FN(mont_mul)(tbl[k],tbl[k - 1],tbl[1],ctx_);
+
+  memcpy(a,tbl[0],sizeof(a));
+  for(size_t i = (elimbs_ * 64); i > 0; i -= MPFW_CT_WINLEN)
+    {
+      uint64_t w;
+
+      for(size_t j = 0; j < MPFW_CT_WINLEN; j++)
+        FN(mont_sqr)(a,a,ctx_);
+
+      w = ((e_[(i - MPFW_CT_WINLEN) / 64] >> ((i - MPFW_CT_WINLEN) % 64)) &
+           ((1 << MPFW_CT_WINLEN) - 1));
+
+      memset(t,0,sizeof(t));
+      for(size_t k = 0; k < (1 << MPFW_CT_WINLEN); k++)
+        {
+          uint64_t mask;
+
+          mask = mpfw_ct_eq(k,w);
+          MPFW_UNROLL
+          for(size_t j = 0; j < N; j++)
+            t[j] |= (tbl[k][j] & mask);
+        }
+
+      FN(mont_mul)(a,a,t,ctx_);
+    }
+
+  FN(mont_mul)(r_,a,one,ctx_);
+
+  memset(tbl,0,sizeof(tbl));
+  memset(a,0,sizeof(a));
+  memset(t,0,sizeof(t));
+}
+
+#undef N
+#undef CTX_T
+#undef FN
+#undef MPFW_CAT
+#undef MPFW_CAT_
@@ -0,0 +1,155 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "parallel.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#define PARALLEL_MAX_THREADS 64
+
+typedef struct parallel_s parallel_t;
+struct parallel_s
+{
+  pthread_mutex_t     lock;
+  size_t              next;
+  size_t              count;
+  parallel_fn_t       fn;
+  parallel_done_fn_t  done;
+  void               *arg;
+};
+
+/*
+ * Threads are pthreads everywhere, mingw-w64 included through
+ * winpthreads. Only the processor count needs a native call there.
+ */
+#if defined(_WIN32)
+size_t
+parallel_ncpus(void)
+{
+  SYSTEM_INFO si;
+
+  GetSystemInfo(&si);
+
+  return ((si.dwNumberOfProcessors > 0) ? (size_t)si.dwNumberOfProcessors : 1);
+}
+#else
+size_t
+parallel_ncpus(void)
+{
+  long n;
+
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return ((n > 0) ? (size_t)n : 1);
+}
+#endif
+
+static
+void
+parallel_run(parallel_t *p_)
+{
+  for(;;)
+    {
+      size_t idx;
+
+      pthread_mutex_lock(&p_->lock);
+      idx = p_->next;
+      if(idx < p_->count)
+        p_->next++;
+      pthread_mutex_unlock(&p_->lock);
+
+      if(idx >= p_->count)
+        break;
+
+      p_->fn(p_->arg,idx);
+    }
+}
+
+static
+void*
+parallel_thread(void *p_)
+{
+  parallel_t *p = p_;
+
+  parallel_run(p);
+  if(p->done)
+    p->done(p->arg);
+
+  return NULL;
+}
+
+/*
+ * Calls fn_(arg_,i) for every i below count_, handing out indexes to
+ * the calling thread and up to nthreads_ - 1 more. done_, if given, is
+ * called by each of the extra threads before it exits so it can free
+ * its thread local state. If threads can't be started the work is
+ * finished on the calling thread.
+ */
+int
+parallel_for(size_t              nthreads_,
+             size_t              count_,
+             parallel_fn_t       fn_,
+             parallel_done_fn_t  done_,
+             void               *arg_)
+{
+  int rv;
+  size_t nstarted;
+  parallel_t p;
+  pthread_t threads[PARALLEL_MAX_THREADS];
+
+  if(nthreads_ > count_)
+    nthreads_ = count_;
+  if(nthreads_ > PARALLEL_MAX_THREADS)
+    nthreads_ = PARALLEL_MAX_THREADS;
+
+  memset(&p,0,sizeof(p));
+  pthread_mutex_init(&p.lock,NULL);
+  p.count = count_;
+  p.fn    = fn_;
+  p.done  = done_;
+  p.arg   = arg_;
+
+  nstarted = 0;
+  for(size_t i = 1; i < nthreads_; i++)
+    {
+      rv = pthread_create(&threads[nstarted],NULL,parallel_thread,&p);
+      if(rv != 0)
+        {
+          fprintf(stderr,"WARNING: unable to start thread - %s\n",strerror(rv));
+          break;
+        }
+      nstarted++;
+    }
+
+  parallel_run(&p);
+
+  for(size_t i = 0; i < nstarted; i++)
+    pthread_join(threads[i],NULL);
+
+  pthread_mutex_destroy(&p.lock);
+
+  return 0;
+}
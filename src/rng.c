@@ -0,0 +1,83 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#if defined(_WIN32)
+#define _CRT_RAND_S
+#endif
+
+#include "rng.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+int
+rng_bytes(void   *buf_,
+          size_t  len_)
+{
+  uint8_t *buf;
+
+  buf = buf_;
+  while(len_ > 0)
+    {
+      size_t n;
+      unsigned int v;
+
+      if(rand_s(&v) != 0)
+        {
+          fprintf(stderr,"ERROR: rand_s failed\n");
+          return -1;
+        }
+
+      n = ((len_ < sizeof(v)) ? len_ : sizeof(v));
+      memcpy(buf,&v,n);
+      buf  += n;
+      len_ -= n;
+    }
+
+  return 0;
+}
+#else
+int
+rng_bytes(void   *buf_,
+          size_t  len_)
+{
+  FILE *file;
+  size_t rv;
+
+  file = fopen("/dev/urandom","rb");
+  if(file == NULL)
+    {
+      fprintf(stderr,"ERROR: failed to open /dev/urandom - %s\n",strerror(errno));
+      return -1;
+    }
+
+  rv = fread(buf_,1,len_,file);
+  fclose(file);
+  if(rv != len_)
+    {
+      fprintf(stderr,"ERROR: short read from /dev/urandom\n");
+      return -1;
+    }
+
+  return 0;
+}
+#endif
@@ -426,6 +426,10 @@ static struct simple_opt_result simple_opt_parse(int argc, char **argv,
 			 * passing */
 			if (i + 1 < argc && s == argv[i+1])
 				i++;
+		} else if (!options[opt_i].arg_is_required && i + 1 < argc
+				&& s == argv[i+1]) {
+			/* an optional arg that doesn't parse is left as a positional */
+			continue;
 		} else {
 			r.result_type = SIMPLE_OPT_RESULT_BAD_ARG;
 			r.option_type = options[opt_i].type;
@@ -0,0 +1,437 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Skip cache for batch runs.
+ *
+ * For every file written the cache records its path, device, inode,
+ * size and modification time along with a fingerprint of whatever
+ * decided its contents: the header options and signing key. A file
+ * whose stat still matches and which was written under the same
+ * fingerprint would be rewritten with the same bytes so the next run
+ * can skip it without reading it.
+ *
+ * Like git's index this trusts a timestamp only if it is older than
+ * the cache file itself. A file changed again within the same
+ * timestamp tick as its recorded write could otherwise keep the same
+ * mtime and size and be skipped wrongly, so such entries are treated
+ * as changed.
+ *
+ * Layout, all integers little-endian:
+ *   magic[8] count:u32
+ *   count * { dev:u64 ino:u64 size:u64 mtime_ns:u64 fingerprint[16]
+ *             pathlen:u32 path }
+ */
+
+#include "skip_cache.h"
+
+#include "md5.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define SKIP_MAGIC      "MBSKIP01"
+#define SKIP_MAGIC_SIZE 8
+#define SKIP_PATH_MAX   4096
+#define SKIP_REC_SIZE   (8 + 8 + 8 + 8 + sizeof(md5_digest_t) + 4)
+
+typedef struct skip_entry_s skip_entry_t;
+struct skip_entry_s
+{
+  char         *path;
+  uint64_t      dev;
+  uint64_t      ino;
+  uint64_t      size;
+  uint64_t      mtime_ns;
+  md5_digest_t  fingerprint;
+};
+
+struct skip_cache_s
+{
+  char         *filepath;
+  md5_digest_t  fingerprint;
+  uint64_t      mtime_ns;
+  skip_entry_t *entries;
+  size_t        count;
+  size_t        cap;
+  size_t        sorted;
+  bool          dirty;
+};
+
+static
+uint64_t
+get_u64_le(const uint8_t *p_)
+{
+  uint64_t v;
+
+  v = 0;
+  for(int i = 7; i >= 0; i--)
+    v = ((v << 8) | p_[i]);
+
+  return v;
+}
+
+static
+uint32_t
+get_u32_le(const uint8_t *p_)
+{
+  return (((uint32_t)p_[0] <<  0) |
+          ((uint32_t)p_[1] <<  8) |
+          ((uint32_t)p_[2] << 16) |
+          ((uint32_t)p_[3] << 24));
+}
+
+static
+void
+put_u64_le(uint8_t  *p_,
+           uint64_t  v_)
+{
+  for(int i = 0; i < 8; i++, v_ >>= 8)
+    p_[i] = (uint8_t)v_;
+}
+
+static
+void
+put_u32_le(uint8_t  *p_,
+           uint32_t  v_)
+{
+  for(int i = 0; i < 4; i++, v_ >>= 8)
+    p_[i] = (uint8_t)v_;
+}
+
+static
+uint64_t
+stat_mtime_ns(const struct stat *st_)
+{
+#if defined(__APPLE__)
+  return (((uint64_t)st_->st_mtimespec.tv_sec * 1000000000ULL) +
+          st_->st_mtimespec.tv_nsec);
+#elif defined(_WIN32)
+  return ((uint64_t)st_->st_mtime * 1000000000ULL);
+#else
+  return (((uint64_t)st_->st_mtim.tv_sec * 1000000000ULL) +
+          st_->st_mtim.tv_nsec);
+#endif
+}
+
+static
+int
+entry_cmp(const void *a_,
+          const void *b_)
+{
+  const skip_entry_t *a = a_;
+  const skip_entry_t *b = b_;
+
+  return strcmp(a->path,b->path);
+}
+
+/* Entries [0,sorted) are sorted by path, the rest were added this run */
+static
+skip_entry_t*
+entry_find(const skip_cache_t *cache_,
+           const char         *filepath_)
+{
+  skip_entry_t key;
+
+  key.path = (char*)filepath_;
+  if(cache_->sorted == 0)
+    return NULL;
+
+  return bsearch(&key,cache_->entries,cache_->sorted,sizeof(skip_entry_t),entry_cmp);
+}
+
+static
+skip_entry_t*
+entry_new(skip_cache_t *cache_,
+          const char   *filepath_)
+{
+  skip_entry_t *e;
+
+  if(cache_->count == cache_->cap)
+    {
+      size_t cap;
+
+      cap = (cache_->cap ? (cache_->cap * 2) : 64);
+      e   = realloc(cache_->entries,(cap * sizeof(skip_entry_t)));
+      if(e == NULL)
+        return NULL;
+      cache_->entries = e;
+      cache_->cap     = cap;
+    }
+
+  e = &cache_->entries[cache_->count];
+  memset(e,0,sizeof(*e));
+  e->path = strdup(filepath_);
+  if(e->path == NULL)
+    return NULL;
+  cache_->count++;
+
+  return e;
+}
+
+static
+void
+skip_load(skip_cache_t *cache_)
+{
+  FILE *file;
+  uint32_t count;
+  uint32_t pathlen;
+  struct stat st;
+  char path[SKIP_PATH_MAX];
+  uint8_t hdr[SKIP_MAGIC_SIZE + 4];
+  uint8_t rec[SKIP_REC_SIZE];
+
+  file = fopen(cache_->filepath,"rb");
+  if(file == NULL)
+    return;
+
+  if((fstat(fileno(file),&st) != 0) ||
+     (fread(hdr,1,sizeof(hdr),file) != sizeof(hdr)) ||
+     memcmp(hdr,SKIP_MAGIC,SKIP_MAGIC_SIZE))
+    {
+      fprintf(stderr,"WARNING: '%s' is not a skip cache. Ignoring.\n",cache_->filepath);
+      fclose(file);
+      return;
+    }
+
+  cache_->mtime_ns = stat_mtime_ns(&st);
+
+  count = get_u32_le(&hdr[SKIP_MAGIC_SIZE]);
+  for(uint32_t i = 0; i < count; i++)
+    {
+      skip_entry_t *e;
+
+      if(fread(rec,1,sizeof(rec),file) != sizeof(rec))
+        break;
+      pathlen = get_u32_le(&rec[SKIP_REC_SIZE - 4]);
+      if(pathlen >= sizeof(path))
+        break;
+      if(fread(path,1,pathlen,file) != pathlen)
+        break;
+      path[pathlen] = '\0';
+
+      e = entry_new(cache_,path);
+      if(e == NULL)
+        break;
+      e->dev      = get_u64_le(&rec[0]);
+      e->ino      = get_u64_le(&rec[8]);
+      e->size     = get_u64_le(&rec[16]);
+      e->mtime_ns = get_u64_le(&rec[24]);
+      memcpy(e->fingerprint,&rec[32],sizeof(md5_digest_t));
+    }
+
+  fclose(file);
+
+  qsort(cache_->entries,cache_->count,sizeof(skip_entry_t),entry_cmp);
+  cache_->sorted = cache_->count;
+}
+
+static
+int
+skip_save(const skip_cache_t *cache_)
+{
+  int rv;
+  FILE *file;
+  char *tmppath;
+  size_t len;
+  uint8_t hdr[SKIP_MAGIC_SIZE + 4];
+  uint8_t rec[SKIP_REC_SIZE];
+
+  len     = strlen(cache_->filepath);
+  tmppath = malloc(len + sizeof(".tmp"));
+  if(tmppath == NULL)
+    return -1;
+  memcpy(tmppath,cache_->filepath,len);
+  memcpy(&tmppath[len],".tmp",sizeof(".tmp"));
+
+  file = fopen(tmppath,"wb");
+  if(file == NULL)
+    {
+      fprintf(stderr,
+              "WARNING: unable to write skip cache '%s' - %s\n",
+              tmppath,
+              strerror(errno));
+      free(tmppath);
+      return -1;
+    }
+
+  memcpy(hdr,SKIP_MAGIC,SKIP_MAGIC_SIZE);
+  put_u32_le(&hdr[SKIP_MAGIC_SIZE],cache_->count);
+
+  rv = ((fwrite(hdr,1,sizeof(hdr),file) == sizeof(hdr)) ? 0 : -1);
+  for(size_t i = 0; (rv == 0) && (i < cache_->count); i++)
+    {
+      const skip_entry_t *e = &cache_->entries[i];
+
+      len = strlen(e->path);
+      put_u64_le(&rec[0],e->dev);
+      put_u64_le(&rec[8],e->ino);
+      put_u64_le(&rec[16],e->size);
+      put_u64_le(&rec[24],e->mtime_ns);
+      memcpy(&rec[32],e->fingerprint,sizeof(md5_digest_t));
+      put_u32_le(&rec[SKIP_REC_SIZE - 4],len);
+
+      if((fwrite(rec,1,sizeof(rec),file) != sizeof(rec)) ||
+         (fwrite(e->path,1,len,file) != len))
+        rv = -1;
+    }
+
+  if(fclose(file) != 0)
+    rv = -1;
+
+#if defined(_WIN32)
+  if(rv == 0)
+    remove(cache_->filepath);
+#endif
+  if((rv == 0) && (rename(tmppath,cache_->filepath) != 0))
+    rv = -1;
+
+  if(rv != 0)
+    {
+      fprintf(stderr,
+              "WARNING: unable to write skip cache '%s' - %s\n",
+              cache_->filepath,
+              strerror(errno));
+      remove(tmppath);
+    }
+
+  free(tmppath);
+
+  return rv;
+}
+
+/*
+ * Loads the cache at filepath_ if there is one. Files are compared
+ * against and recorded with fingerprint_.
+ */
+skip_cache_t*
+skip_cache_open(const char         *filepath_,
+                const md5_digest_t  fingerprint_)
+{
+  skip_cache_t *cache;
+
+  cache = calloc(1,sizeof(skip_cache_t));
+  if(cache == NULL)
+    return NULL;
+
+  cache->filepath = strdup(filepath_);
+  if(cache->filepath == NULL)
+    {
+      free(cache);
+      return NULL;
+    }
+
+  memcpy(cache->fingerprint,fingerprint_,sizeof(md5_digest_t));
+  skip_load(cache);
+
+  return cache;
+}
+
+/* Saves the cache if anything was recorded and frees it */
+int
+skip_cache_close(skip_cache_t *cache_)
+{
+  int rv;
+
+  if(cache_ == NULL)
+    return 0;
+
+  rv = 0;
+  if(cache_->dirty)
+    {
+      size_t n;
+
+      /* A path given twice in one run is recorded twice; keep one */
+      qsort(cache_->entries,cache_->count,sizeof(skip_entry_t),entry_cmp);
+      n = 0;
+      for(size_t i = 0; i < cache_->count; i++)
+        {
+          if((n > 0) && !strcmp(cache_->entries[n - 1].path,cache_->entries[i].path))
+            {
+              free(cache_->entries[i].path);
+              continue;
+            }
+          cache_->entries[n++] = cache_->entries[i];
+        }
+      cache_->count = n;
+
+      rv = skip_save(cache_);
+    }
+
+  for(size_t i = 0; i < cache_->count; i++)
+    free(cache_->entries[i].path);
+  free(cache_->entries);
+  free(cache_->filepath);
+  free(cache_);
+
+  return rv;
+}
+
+bool
+skip_cache_unchanged(const skip_cache_t *cache_,
+                     const char         *filepath_)
+{
+  struct stat st;
+  const skip_entry_t *e;
+
+  e = entry_find(cache_,filepath_);
+  if(e == NULL)
+    return false;
+  if(memcmp(e->fingerprint,cache_->fingerprint,sizeof(md5_digest_t)))
+    return false;
+  if(e->mtime_ns >= cache_->mtime_ns)
+    return false;
+  if(stat(filepath_,&st) != 0)
+    return false;
+
+  return ((e->dev      == (uint64_t)st.st_dev)  &&
+          (e->ino      == (uint64_t)st.st_ino)  &&
+          (e->size     == (uint64_t)st.st_size) &&
+          (e->mtime_ns == stat_mtime_ns(&st)));
+}
+
+/* Records filepath_ as just written under the cache's fingerprint */
+void
+skip_cache_record(skip_cache_t *cache_,
+                  const char   *filepath_)
+{
+  struct stat st;
+  skip_entry_t *e;
+
+  if(stat(filepath_,&st) != 0)
+    return;
+
+  e = entry_find(cache_,filepath_);
+  if(e == NULL)
+    e = entry_new(cache_,filepath_);
+  if(e == NULL)
+    return;
+
+  e->dev      = st.st_dev;
+  e->ino      = st.st_ino;
+  e->size     = st.st_size;
+  e->mtime_ns = stat_mtime_ns(&st);
+  memcpy(e->fingerprint,cache_->fingerprint,sizeof(md5_digest_t));
+
+  cache_->dirty = true;
+}
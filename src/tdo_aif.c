@@ -16,6 +16,8 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "tdo_aif.h"
+
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -472,7 +474,7 @@ bool
 tdo_aif_is_aif(void   *buf_,
                size_t  size_)
 {
-  if(size_ < 256)
+  if(size_ < TDO_AIF_HEADER_SIZE)
     return false;
 
   if(get_word(buf_,0) != NOP && get_byte(buf_,0) != BL)
@@ -22,6 +22,7 @@
 #include <stdint.h>
 #include <stdio.h>
 
+#define TDO_AIF_HEADER_SIZE 256
 
 void tdo_aif_set_3do_flag(void *buf);
 void tdo_aif_reset_3do_flag(void *buf);
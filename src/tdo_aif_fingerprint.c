@@ -0,0 +1,66 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_aif_fingerprint.h"
+
+#include "md5.h"
+#include "tdo_aif.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * MD5 over the image with every field modbin can set returned to its
+ * reset value and any signature tail dropped. Two executables with
+ * the same fingerprint differ only in header metadata.
+ */
+void
+tdo_aif_fingerprint(const void   *buf_,
+                    size_t        size_,
+                    md5_digest_t  digest_)
+{
+  size_t size;
+  size_t hdr_size;
+  md5_ctx_t ctx;
+  const uint8_t *buf;
+  md5_iov_t iov[2];
+  uint8_t hdr[TDO_AIF_HEADER_SIZE];
+
+  buf  = buf_;
+  size = size_;
+
+  hdr_size = ((size < sizeof(hdr)) ? size : sizeof(hdr));
+  memset(hdr,0,sizeof(hdr));
+  memcpy(hdr,buf,hdr_size);
+
+  tdo_aif_reset(hdr,&size);
+  if(size > size_)
+    size = size_;
+  if(hdr_size > size)
+    hdr_size = size;
+
+  iov[0].base = hdr;
+  iov[0].len  = hdr_size;
+  iov[1].base = &buf[hdr_size];
+  iov[1].len  = (size - hdr_size);
+
+  md5_init(&ctx);
+  md5_update_iov(&ctx,iov,2);
+  md5_finalize(&ctx,digest_);
+}
@@ -0,0 +1,258 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+
+#include "tdo_aif_kat.h"
+
+#include "bigd.h"
+#include "md5.h"
+#include "str.h"
+#include "tdo_aif_signing.h"
+#include "tdo_key_ctx.h"
+#include "tdo_keyfile.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+
+/*
+ * Known answers: PKCS#1 v1.5 MD5 signatures of the RFC 1321 test
+ * messages computed outside of modbin. The retail keys take the fixed
+ * width backend where it is built. The 3072 bit key below only runs
+ * through bigd and is long enough to reach Karatsuba multiplication
+ * with 32 or 64 bit digits, Comba below it and Barrett reduction when
+ * blinding.
+ */
+
+typedef struct kat_vector_s kat_vector_t;
+struct kat_vector_s
+{
+  const char *key;
+  const char *msg;
+  const char *sig;
+};
+
+static const char KAT_K3072_N[] =
+  "A1113A9B33FDCC05D3C2F5AFE8249B7F449D4B0C14C2802A81BF559207A45000"
+  "2C080E843F28784833CF1E322A42A4E12D7D426284DF56AFEE494CE5D3CA252A"
+  "80DCAFEE3408F92EA92B6F37536202FED725411D74E8FDD513694AB259EEFA71"
+  "3CB7E77211D0966D3FB2AF18381638B6A68553C7C7A6B8DED082E0B25B8996DB"
+  "E82CD67D7ACD4EB202B61EF738E44C8380BA448B7406FE984907E7D878A60220"
+  "98594ACA9486CFFD0A3DF37A50E6276AF8CD61B2F67DE2DC367E022CB6369479"
+  "59C01E3DFB1B9C6C9D40FBA249F3B5252F2BAB60C2004EED2B4FCB37792E6EF5"
+  "4CB3208A9F9721681F77941088CD5BEDBF1AD4155DBAE9D2149F48F39245D7B6"
+  "CE2C14CA26FACCEA6EAF42B7F70B6C3E1C7B53A060394CC2174BABE5FF99F745"
+  "A153D7EB9834FE6019412DDBA91637E714D8AFC6D9F3C66AD4EC57E21A5D32F2"
+  "AC74D5E4797756802A9386B901E22BCD157F046660E6CD68AB7D082191DB876C"
+  "EC5B25E123E998E48A8B18DB13B2D212ADD124125AAA92D109ABD26FE3C7A131";
+
+static const char KAT_K3072_E[] =
+  "10001";
+
+static const char KAT_K3072_D[] =
+  "D5D5E9D8E3CDAF708D13E8DB01789878FEBF554354CC651C09E5DBD5640FE1A6"
+  "58CED976F9E2E0CDFAFA9F3C3A9F0007743D384553E2AF5423276DD032BDCD5A"
+  "007AFD9761BE0814CAC3BF83D44FEB6A2A786B5A903C43C2FF626AA91E7D0842"
+  "0E3A9A2BF73AD67B7475E5C061B61ED55F7EE31BF9147F9C517770995AADF07B"
+  "446342E09488BE51D707B354C55353C1C2C588FB1BAFAD92C0629E8BE6A17F71"
+  "86D20559AE96CCCB452DBA7249B545DFDF31CCE3AC1CB573676523BDF8ABBDB0"
+  "C30209FF1D224008BD14E7930857D1763162C3516EFF7CF754285AF26198E2DB"
+  "844072C1A9FFED6804A1FFB05074B0DEAE26DDBFB0EE48AA25A2F86F16C22D96"
+  "DB352A0AAD651B97524676B901160B91AD0455D72630F4129FA8151EE0D08665"
+  "7CB61C2850A8BAED6AD12866AB4BF86521C23F585A26831856338F9C0DD559AB"
+  "D40C3D95E93D3ED3C9A3E77A502573F12DF8EB6AED9A9C0B96B583CE776DDF6C"
+  "B1C7BDA02F8BCCF7EEEEC555C3CF01E8281B48065478A24DD14FB510676C039";
+
+static const char KAT_K3072_P[] =
+  "CFF71683CD8364FEB4E19BD5A1DB624E001C23A04FEE56CB1C52B840B07CB59B"
+  "107AD05172BF17509BAFB4B59864BDDF4A704B7998847E1AEB6CC99FCB4C6F93"
+  "3CAE504CA956F00A5644D172C768D49036B26D99EFF14EB0D333AA1D8D7C9EEA"
+  "2FCF9B3C028AB1DD86244A4F3CB53C1FAD490F6786E5243CF9C94193EBBDDED8"
+  "CE9382FB5E938086E33A92C9522067606DFC23261B71AA41E46A8D8C90FB7601"
+  "E8EB73713B77DE78F4777C2A507A7CEE3C4F756463453F685444929075597B0F";
+
+static const char KAT_K3072_Q[] =
+  "C64515A88CF781C6FBF691AD41D050BA5D6780714DC5939AFE6B301291AD18F3"
+  "7E83D995D49E59705767D30FC2122E85F0155C86A3169DBB8B43EBD4E8D17933"
+  "7444CA3BE45052C3B6F987055FFC302EE8734E43D6699F26C4D0C447F521170B"
+  "7FBF1A6B495A0C0B74847E73FADEDAAE609272A158250CC34B9D2F7E04DC997C"
+  "DFE175D5B08924BAA47D0E962C21FA96EC4E8CF934F6F1E4403E2E7ECC292838"
+  "06C4031A30CFE4064A5BC468CDA82B2D2B8A944FEB28B809EF08230FD6021FBF";
+
+static const kat_vector_t KAT_VECTORS[] =
+  {
+   {"app","",
+    "4CB0F7F8725DAE6ECDAC4E303B30ACE89FB1CCA585BFD0A2759E969DE397D329"
+    "8FC750D37EADD3721DC2FECAA06A7FE2B158A17CA512B56B535F6DD870960D23"},
+   {"app","abc",
+    "0D8CF4AB35AB6FFE9F06CDB4EF965E760300CE91167AEE5DC024E2A8780B5E5A"
+    "5DA7E19F7DDD46F0ECED16FAC08BD2A495AA07CAA007AB76B22C5FB1C4D2863A"},
+   {"app","message digest",
+    "678DC3F007A29C4D6F9F8B093F5660C21B27AE0D70F018475A20637672246579"
+    "E24FB00F1B2BBCA7D833A2FC22D5AE391626FCA29E64B1AA1E47B91B086B945A"},
+   {"3do","",
+    "1E8E17B396CFE8B8834F1EED7ED7691C92E59623C32EB7257BB7469D00D67442"
+    "07AE4E0EDC73E9F8D533E79B6926C9D52417D55E188C03B5B9C964A3D6FB3F89"},
+   {"3do","abc",
+    "3243A486D4FDE815918A69F3F4615225FA09B0810A477A6B46217B8EAD0B1EC7"
+    "375866382FE93A9521F48C5A671DA473DA79A3034A72A7A42A1E8427A99E3DE3"},
+   {"3do","message digest",
+    "A12AE6300EAF3F0D5CC9B8C628B95547068D53159E94697996C3E960CFB603BE"
+    "036422A9A6081A251361B1848C28726AA77A9A0C51262DAF6C9B4EB6C90ECF18"},
+   {"kat3072","abc",
+    "9A4528832B4A42A4C5861DCC9B31269DCB3532E4D1A9A1794F35B584A4EE36E5"
+    "7AF391CF60003DC59489DC25F5FA6B2884913CB6B0FAFC991F497A8718225975"
+    "280D29ED8917A578E08B0F22EE19C878DD53EE636260DFAAB06A24810FA6416E"
+    "31E81DF73F165EB8E0E53B7C2AB3DB25E0124DD723062AE6018AC1230CEF0FF3"
+    "8CA8EA6EB404F71F60C8BA997435E5663D8960A3B9404F89CDBAF61DA23430FE"
+    "B15C143B3953BB75C3E5A04B6C9FC1665CA51F291D115E9450621BE81163660A"
+    "4227069B91B561E4583449643FDD6ED787F257ED21EB0ECD9063D477C6081FB5"
+    "EA57771E7DA632434EBAA46C66446E66990264F247061C32EC214533AF18538E"
+    "3DE858D26F4E8570D4F9129DCFBC59FEF78F161BC022F0A3B528E537D8E0CB48"
+    "42BAD9EF9E2655B47929F925283F4AF46C1F9C1DE8CDBA47A824D5E575DE1C88"
+    "F454F10D3FC553885E7C1F93DAE02F8C764C2994FD1780B7163E0071569A25B2"
+    "15DCF9E5C01FFFD4E7AF3EA0C36982125023BBBEB11405AD915B38A220EA3C50"},
+   {NULL,NULL,NULL}
+  };
+
+static const struct { bool ct; bool blind; } KAT_MODES[] =
+  {
+   {false, false},
+   {true,  false},
+   {false, true},
+   {true,  true},
+  };
+
+static
+int
+kat_key_init(tdo_key_ctx_t *ctx_)
+{
+  tdo_keyfile_t kf;
+
+  memset(&kf,0,sizeof(kf));
+  bdNewVars(&kf.n,&kf.e,&kf.d,&kf.p,&kf.q,NULL);
+  bdConvFromHex(kf.n,KAT_K3072_N);
+  bdConvFromHex(kf.e,KAT_K3072_E);
+  bdConvFromHex(kf.d,KAT_K3072_D);
+  bdConvFromHex(kf.p,KAT_K3072_P);
+  bdConvFromHex(kf.q,KAT_K3072_Q);
+
+  return tdo_key_ctx_init_keyfile(ctx_,"kat3072",&kf);
+}
+
+/* Signs every vector for key_ in every mode, returns the mismatches */
+static
+size_t
+kat_run(const tdo_key_ctx_t *key_)
+{
+  int rv;
+  BIGD b;
+  size_t bad;
+  md5_ctx_t ctx;
+  md5_digest_t digest;
+  tdo_aif_sign_opts_t opts;
+  uint8_t sig[TDO_AIF_SIG_MAX_SIZE];
+  uint8_t expected[TDO_AIF_SIG_MAX_SIZE];
+
+  b = bdNew();
+
+  memset(&opts,0,sizeof(opts));
+  opts.key = key_;
+
+  bad = 0;
+  for(const kat_vector_t *v = KAT_VECTORS; v->key != NULL; v++)
+    {
+      if(!streq(v->key,key_->name))
+        continue;
+
+      md5_init(&ctx);
+      md5_update(&ctx,v->msg,strlen(v->msg));
+      md5_finalize(&ctx,digest);
+
+      bdConvFromHex(b,v->sig);
+      bdConvToOctets(b,expected,key_->size);
+
+      for(size_t i = 0; i < (sizeof(KAT_MODES) / sizeof(KAT_MODES[0])); i++)
+        {
+          opts.constant_time = KAT_MODES[i].ct;
+          opts.blind         = KAT_MODES[i].blind;
+
+          memset(sig,0,sizeof(sig));
+          rv = tdo_aif_sign_digest(&opts,digest,sig);
+          if((rv < 0) || memcmp(sig,expected,key_->size))
+            bad++;
+        }
+    }
+
+  bdFree(&b);
+
+  return bad;
+}
+
+static
+int
+kat_report(const char          *name_,
+           const tdo_key_ctx_t *key_)
+{
+  size_t bad;
+
+  if(key_ == NULL)
+    {
+      printf("  %-20s FAILED (key not loaded)\n",name_);
+      return -1;
+    }
+
+  bad = kat_run(key_);
+
+  printf("  %-20s %s",name_,((bad == 0) ? "OK" : "FAILED"));
+  if(bad)
+    printf(" (%zu signatures differ)",bad);
+  printf("\n");
+
+  return ((bad == 0) ? 0 : -1);
+}
+
+/*
+ * Loads the retail key contexts if needed so must not run while other
+ * threads are signing.
+ */
+int
+tdo_aif_kat(void)
+{
+  int rv;
+  tdo_key_ctx_t ctx;
+
+  printf("known answers: app, 3do and a 3072 bit key, every signing mode\n");
+
+  rv = 0;
+  if(kat_report("app",tdo_key_ctx_get("app")) < 0)
+    rv = -1;
+  if(kat_report("3do",tdo_key_ctx_get("3do")) < 0)
+    rv = -1;
+
+  if(kat_key_init(&ctx) < 0)
+    {
+      kat_report("3072 bit",NULL);
+      return -1;
+    }
+  if(kat_report("3072 bit",&ctx) < 0)
+    rv = -1;
+  tdo_key_ctx_free(&ctx);
+
+  return rv;
+}
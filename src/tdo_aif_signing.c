@@ -16,58 +16,638 @@
   OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
 */
 
+#include "tdo_aif_signing.h"
+
+#include "bigdigits.h"
 #include "fileio.h"
 #include "md5.h"
+#include "mpfw.h"
+#include "mpfw4.h"
+#include "parallel.h"
+#include "rng.h"
 #include "tdo_aif.h"
+#include "tdo_key_ctx.h"
 #include "tdo_keys.h"
 
 #include <errno.h>
+#include <setjmp.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-#define RSA512_SIG_SIZE 64
+typedef unsigned char rsa_sig_t[TDO_AIF_SIG_MAX_SIZE];
 
-typedef unsigned char rsa512_sig_t[RSA512_SIG_SIZE];
+static bool verify_digest(const tdo_key_ctx_t *key,
+                          md5_digest_t         digest,
+                          const uint8_t       *sig);
 
 static
 void
-calculate_md5(const char   *data_,
-              md5_size_t    size_,
-              md5_digest_t  digest_)
+calculate_md5(const md5_iov_t *iov_,
+              md5_size_t       iovcnt_,
+              md5_digest_t     digest_)
 {
   md5_ctx_t ctx;
 
   md5_init(&ctx);
-  md5_update(&ctx,data_,size_);
+  md5_update_iov(&ctx,iov_,iovcnt_);
   md5_finalize(&ctx,digest_);
 }
 
+/*
+ * bigdigits reports failures (out of memory) through mpFail() which
+ * by default exits. While a guarded call is running the thread's
+ * handler jumps back to it instead so only that call fails.
+ */
+typedef struct bn_guard_s bn_guard_t;
+struct bn_guard_s
+{
+  jmp_buf     env;
+  const char *msg;
+};
+
 static
 void
-sign_md5_digest(const char   *key_,
-                md5_digest_t  digest_,
-                rsa512_sig_t  sig_)
+bn_guard_fail(const char *msg_,
+              void       *arg_)
+{
+  bn_guard_t *guard = arg_;
+
+  guard->msg = msg_;
+  longjmp(guard->env,1);
+}
+
+/*
+ * bigd temporaries for the generic path. Created on first use per
+ * thread and kept so their digit arrays stop being resized once they
+ * have grown to the key size.
+ */
+typedef struct sign_scratch_s sign_scratch_t;
+struct sign_scratch_s
 {
-  BIGD n;
-  BIGD d;
   BIGD m;
   BIGD s;
+  BIGD v;
+  BIGD t;
+  BIGD h;
+  BIGD s1;
+  BIGD s2;
+};
+
+static MP_THREAD_LOCAL sign_scratch_t g_scratch;
+
+static
+sign_scratch_t*
+sign_scratch(void)
+{
+  if(g_scratch.m == NULL)
+    bdNewVars(&g_scratch.m,&g_scratch.s,&g_scratch.v,&g_scratch.t,
+              &g_scratch.h,&g_scratch.s1,&g_scratch.s2,NULL);
+
+  return &g_scratch;
+}
+
+/*
+ * s = m^d mod n via the CRT:
+ *   s1 = m^dp mod p, s2 = m^dq mod q
+ *   h  = qinv * (s1 - s2) mod p
+ *   s  = s2 + h * q
+ */
+static
+void
+sign_crt(sign_scratch_t      *x_,
+         const tdo_key_ctx_t *key_,
+         bool                 ct_)
+{
+  int (*modexp)(BIGD,BIGD,BIGD,BIGD);
+
+  modexp = (ct_ ? bdModExp_ct : bdModExp);
+
+  bdModulo(x_->t,x_->m,key_->p);
+  modexp(x_->s1,x_->t,key_->dp,key_->p);
+  bdModulo(x_->t,x_->m,key_->q);
+  modexp(x_->s2,x_->t,key_->dq,key_->q);
+
+  bdModulo(x_->t,x_->s2,key_->p);
+  bdModSub(x_->h,x_->s1,x_->t,key_->p);
+  bdModMult(x_->t,x_->h,key_->qinv,key_->p);
+  bdMultiply(x_->h,x_->t,key_->q);
+  bdAdd(x_->s,x_->h,x_->s2);
+}
+
+#if MPFW_AVAILABLE
+/*
+ * Garner recombination of the two CRT halves plus the public
+ * exponent check on the 512-bit kernels. m is the message limbs.
+ */
+static
+int
+crt_combine_fw(rsa_sig_t            sig_,
+               const uint64_t       m_[MPFW512_LIMBS],
+               const uint64_t       s1_[MPFW256_LIMBS],
+               const uint64_t       s2_[MPFW256_LIMBS],
+               const tdo_key_ctx_t *key_)
+{
+  uint64_t s[MPFW512_LIMBS];
+  uint64_t v[MPFW512_LIMBS];
+  uint64_t w[MPFW512_LIMBS];
+  uint64_t h[MPFW256_LIMBS];
+
+  memset(w,0,sizeof(w));
+  memcpy(w,s2_,(MPFW256_LIMBS * sizeof(uint64_t)));
+  mpfw256_mod_wide(h,w,&key_->pmont);
+  mpfw256_mod_sub(h,s1_,h,&key_->pmont);
+  mpfw256_mul(w,h,key_->fw_qinv);
+  mpfw256_mod_wide(h,w,&key_->pmont);
+  mpfw256_mul_add(s,h,key_->qmont.n,s2_);
+
+  mpfw512_modexp_sched(v,s,&key_->fw_e,&key_->nmont);
+  if(memcmp(v,m_,sizeof(v)) != 0)
+    return -1;
+
+  mpfw512_to_octets(s,sig_,key_->size);
+
+  return 0;
+}
+
+/*
+ * Same CRT as sign_crt() but on the fixed width backend: the halves
+ * run on 256-bit limbs and the public exponent check on 512-bit.
+ * Returns -1 when the key doesn't fit those sizes or the check fails
+ * so the caller can fall back to bigd. With ct the halves use the
+ * fixed window exponentiation.
+ */
+static
+int
+sign_crt_fw(rsa_sig_t            sig_,
+            const uint8_t       *msg_,
+            const tdo_key_ctx_t *key_,
+            bool                 ct_)
+{
+  uint64_t m[MPFW512_LIMBS];
+  uint64_t s1[MPFW256_LIMBS];
+  uint64_t s2[MPFW256_LIMBS];
+  uint64_t h[MPFW256_LIMBS];
+
+  if(!key_->fw)
+    return -1;
+
+  mpfw512_from_octets(m,msg_,TDO_KEYS_M1_RETAIL_MSG_SIZE);
+
+  if(ct_)
+    {
+      mpfw256_mod_wide(h,m,&key_->pmont);
+      mpfw256_modexp_ct(s1,h,key_->fw_dp_limbs,MPFW256_LIMBS,&key_->pmont);
+      mpfw256_mod_wide(h,m,&key_->qmont);
+      mpfw256_modexp_ct(s2,h,key_->fw_dq_limbs,MPFW256_LIMBS,&key_->qmont);
+    }
+  else
+    {
+      mpfw256_mod_wide(h,m,&key_->pmont);
+      mpfw256_modexp_sched(s1,h,&key_->fw_dp,&key_->pmont);
+      mpfw256_mod_wide(h,m,&key_->qmont);
+      mpfw256_modexp_sched(s2,h,&key_->fw_dq,&key_->qmont);
+    }
+
+  return crt_combine_fw(sig_,m,s1,s2,key_);
+}
+
+/*
+ * Four messages at once: both CRT halves go through the lane-parallel
+ * exponentiation. Lanes whose check fails are left for the caller.
+ */
+static
+void
+sign_crt_fw_x4(rsa_sig_t            sigs_[MPFW4_LANES],
+               int                  rv_[MPFW4_LANES],
+               const uint8_t        msgs_[MPFW4_LANES][TDO_KEYS_M1_RETAIL_MSG_SIZE],
+               const tdo_key_ctx_t *key_)
+{
+  uint64_t m[MPFW4_LANES][MPFW512_LIMBS];
+  uint64_t x[MPFW4_LANES][MPFW256_LIMBS];
+  uint64_t s1[MPFW4_LANES][MPFW256_LIMBS];
+  uint64_t s2[MPFW4_LANES][MPFW256_LIMBS];
+
+  for(size_t i = 0; i < MPFW4_LANES; i++)
+    {
+      mpfw512_from_octets(m[i],msgs_[i],TDO_KEYS_M1_RETAIL_MSG_SIZE);
+      mpfw256_mod_wide(x[i],m[i],&key_->pmont);
+    }
+  mpfw4_256_modexp_sched(s1,(const uint64_t(*)[MPFW256_LIMBS])x,&key_->fw_dp,&key_->p4mont);
+
+  for(size_t i = 0; i < MPFW4_LANES; i++)
+    mpfw256_mod_wide(x[i],m[i],&key_->qmont);
+  mpfw4_256_modexp_sched(s2,(const uint64_t(*)[MPFW256_LIMBS])x,&key_->fw_dq,&key_->q4mont);
+
+  for(size_t i = 0; i < MPFW4_LANES; i++)
+    rv_[i] = crt_combine_fw(sigs_[i],m[i],s1[i],s2[i],key_);
+}
+#else
+static
+int
+sign_crt_fw(rsa_sig_t            sig_,
+            const uint8_t       *msg_,
+            const tdo_key_ctx_t *key_,
+            bool                 ct_)
+{
+  return -1;
+}
+#endif
+
+/*
+ * Base blinding: the message is multiplied by vi = r^e before signing
+ * and the result by vf = r^-1 after, so the private exponentiation
+ * never sees the caller's message. Each use squares both factors
+ * rather than drawing a new r. One pair per key per thread, found by
+ * the key's id rather than its context's address which may be reused
+ * by a different key.
+ */
+#define SIGN_BLIND_SLOTS 4
+
+typedef struct sign_blind_s sign_blind_t;
+struct sign_blind_s
+{
+  bool    used;
+  uint8_t id[TDO_KEY_CTX_ID_SIZE];
+  uint8_t vi[TDO_AIF_SIG_MAX_SIZE];
+  uint8_t vf[TDO_AIF_SIG_MAX_SIZE];
+};
+
+static MP_THREAD_LOCAL sign_blind_t g_blind[SIGN_BLIND_SLOTS];
+
+/* r = a * b mod n, all big-endian octets below n */
+static
+void
+blind_mulmod(uint8_t             *r_,
+             const uint8_t       *a_,
+             const uint8_t       *b_,
+             const tdo_key_ctx_t *key_)
+{
+  size_t mark;
+  sign_scratch_t *x;
+
+#if MPFW_AVAILABLE
+  if(key_->fw)
+    {
+      uint64_t a[MPFW512_LIMBS];
+      uint64_t b[MPFW512_LIMBS];
+      uint64_t t[2 * MPFW512_LIMBS];
+
+      mpfw512_from_octets(a,a_,key_->size);
+      mpfw512_from_octets(b,b_,key_->size);
+      mpfw512_mul(t,a,b);
+      mpfw512_mod_wide(a,t,&key_->nmont);
+      mpfw512_to_octets(a,r_,key_->size);
+      return;
+    }
+#endif
+
+  x    = sign_scratch();
+  mark = mpScratchBegin();
+
+  bdConvFromOctets(x->t,a_,key_->size);
+  bdConvFromOctets(x->h,b_,key_->size);
+  bdModMult(x->v,x->t,x->h,key_->n);
+  bdConvToOctets(x->v,r_,key_->size);
+
+  mpScratchEnd(mark);
+}
+
+static
+int
+blind_init(sign_blind_t        *b_,
+           const tdo_key_ctx_t *key_)
+{
+  int rv;
+  size_t mark;
+  sign_scratch_t *x;
+  uint8_t r[TDO_AIF_SIG_MAX_SIZE];
+
+  x    = sign_scratch();
+  mark = mpScratchBegin();
+
+  rv = -1;
+  for(int tries = 0; tries < 8; tries++)
+    {
+      if(rng_bytes(r,key_->size) < 0)
+        break;
+      r[0] &= 0x7F;
+
+      bdConvFromOctets(x->t,r,key_->size);
+      if(bdIsZero(x->t) || (bdModInv(x->h,x->t,key_->n) != 0))
+        continue;
+
+      bdModExp(x->v,x->t,key_->e,key_->n);
+      bdConvToOctets(x->v,b_->vi,key_->size);
+      bdConvToOctets(x->h,b_->vf,key_->size);
+      memcpy(b_->id,key_->id,sizeof(b_->id));
+      b_->used = true;
+      rv = 0;
+      break;
+    }
+
+  memset(r,0,sizeof(r));
+  bdSetZero(x->t);
+  bdSetZero(x->h);
+  bdSetZero(x->v);
 
-  n = tdo_keys_n(key_);
-  d = tdo_keys_d(key_);
-  m = tdo_keys_m(key_,digest_);
-  s = bdNew();
+  mpScratchEnd(mark);
 
-  bdModExp(s,m,d,n);
+  if(rv < 0)
+    fprintf(stderr,"ERROR: unable to generate blinding factor\n");
 
-  bdConvToOctets(s,sig_,sizeof(rsa512_sig_t));
+  return rv;
+}
+
+static
+sign_blind_t*
+blind_get(const tdo_key_ctx_t *key_)
+{
+  sign_blind_t *b;
+
+  b = &g_blind[0];
+  for(size_t i = 0; i < SIGN_BLIND_SLOTS; i++)
+    {
+      if(g_blind[i].used && !memcmp(g_blind[i].id,key_->id,sizeof(key_->id)))
+        return &g_blind[i];
+      if(!g_blind[i].used)
+        {
+          b = &g_blind[i];
+          break;
+        }
+    }
+
+  if(blind_init(b,key_) < 0)
+    return NULL;
+
+  return b;
+}
+
+/*
+ * Frees the calling thread's signing state: scratch BIGDs, blinding
+ * factors and the bignum scratch arena. Worker threads must call
+ * this before exiting or the memory is lost with the thread.
+ */
+void
+tdo_aif_sign_release(void)
+{
+  if(g_scratch.m != NULL)
+    bdFreeVars(&g_scratch.m,&g_scratch.s,&g_scratch.v,&g_scratch.t,
+               &g_scratch.h,&g_scratch.s1,&g_scratch.s2,NULL);
+  memset(&g_scratch,0,sizeof(g_scratch));
+  memset(g_blind,0,sizeof(g_blind));
+  mpScratchRelease();
+}
+
+static
+void
+sign_msg(const tdo_aif_sign_opts_t *opts_,
+         const uint8_t             *msg_,
+         rsa_sig_t                  sig_)
+{
+  size_t mark;
+  sign_scratch_t *x;
+  const tdo_key_ctx_t *key = opts_->key;
+
+  if(sign_crt_fw(sig_,msg_,key,opts_->constant_time) == 0)
+    return;
+
+  x    = sign_scratch();
+  mark = mpScratchBegin();
+
+  bdConvFromOctets(x->m,msg_,key->size);
+
+  sign_crt(x,key,opts_->constant_time);
+
+  /*
+   * A fault in either half of the CRT would leak the factorization
+   * and produce a bad signature so check the result with the public
+   * exponent and fall back to the plain exponentiation on mismatch.
+   */
+  bdModExp(x->v,x->s,key->e,key->n);
+  if(!bdIsEqual(x->v,x->m))
+    {
+      fprintf(stderr,"WARNING: CRT signature self-check failed. Using non-CRT result.\n");
+      if(opts_->constant_time)
+        bdModExp_ct(x->s,x->m,key->d,key->n);
+      else
+        bdModExp(x->s,x->m,key->d,key->n);
+    }
+
+  bdConvToOctets(x->s,sig_,key->size);
+
+  bdSetZero(x->t);
+  bdSetZero(x->h);
+  bdSetZero(x->s1);
+  bdSetZero(x->s2);
+
+  mpScratchEnd(mark);
+}
+
+static
+int
+sign_md5_digest(const tdo_aif_sign_opts_t *opts_,
+                md5_digest_t               digest_,
+                rsa_sig_t                  sig_)
+{
+  sign_blind_t *b;
+  uint8_t msg[TDO_KEYS_MSG_MAX_SIZE];
+
+  tdo_key_ctx_message(opts_->key,digest_,msg);
+  if(!opts_->blind)
+    {
+      sign_msg(opts_,msg,sig_);
+      return 0;
+    }
+
+  b = blind_get(opts_->key);
+  if(b == NULL)
+    return -1;
+
+  blind_mulmod(msg,msg,b->vi,opts_->key);
+  sign_msg(opts_,msg,sig_);
+  blind_mulmod(sig_,sig_,b->vf,opts_->key);
+
+  blind_mulmod(b->vi,b->vi,b->vi,opts_->key);
+  blind_mulmod(b->vf,b->vf,b->vf,opts_->key);
+
+  return 0;
+}
+
+/*
+ * Sign count digests with the same key. Full groups of four share the
+ * lane-parallel exponentiation; the rest (and any lane failing its
+ * check) go through sign_md5_digest(). The lanes run the variable
+ * time schedule so hardened signing takes the single path.
+ */
+static
+int
+sign_md5_digests(const tdo_aif_sign_opts_t *opts_,
+                 md5_digest_t              *digests_,
+                 rsa_sig_t                 *sigs_,
+                 size_t                     count_)
+{
+  size_t i;
+
+  i = 0;
+#if MPFW_AVAILABLE
+  for(; (opts_->key->fw &&
+         !opts_->constant_time &&
+         !opts_->blind &&
+         ((i + MPFW4_LANES) <= count_)); i += MPFW4_LANES)
+    {
+      int rv[MPFW4_LANES];
+      uint8_t msgs[MPFW4_LANES][TDO_KEYS_M1_RETAIL_MSG_SIZE];
+
+      for(size_t j = 0; j < MPFW4_LANES; j++)
+        tdo_key_ctx_message(opts_->key,digests_[i + j],msgs[j]);
+
+      sign_crt_fw_x4(&sigs_[i],rv,(const uint8_t(*)[TDO_KEYS_M1_RETAIL_MSG_SIZE])msgs,opts_->key);
+
+      for(size_t j = 0; j < MPFW4_LANES; j++)
+        {
+          if(rv[j] < 0)
+            sign_msg(opts_,msgs[j],sigs_[i + j]);
+        }
+    }
+#endif
+
+  for(; i < count_; i++)
+    {
+      if(sign_md5_digest(opts_,digests_[i],sigs_[i]) < 0)
+        return -1;
+    }
+
+  return 0;
+}
+
+static
+int
+sign_md5_digests_guarded(const tdo_aif_sign_opts_t *opts_,
+                         md5_digest_t              *digests_,
+                         rsa_sig_t                 *sigs_,
+                         size_t                     count_)
+{
+  int rv;
+  bn_guard_t guard;
+
+  if(setjmp(guard.env) != 0)
+    {
+      fprintf(stderr,"ERROR: signing failed - %s\n",guard.msg);
+      return -1;
+    }
+
+  mpSetFailHandler(bn_guard_fail,&guard);
+  rv = sign_md5_digests(opts_,digests_,sigs_,count_);
+  mpSetFailHandler(NULL,NULL);
 
-  bdFree(&s);
-  bdFree(&m);
-  bdFree(&d);
-  bdFree(&n);
+  return rv;
+}
+
+/*
+ * A cached signature is only used once it checks out against the
+ * public key, which costs far less than making it again.
+ */
+static
+bool
+sign_cache_get(const tdo_aif_sign_opts_t *opts_,
+               md5_digest_t               digest_,
+               rsa_sig_t                  sig_)
+{
+  bool ok;
+  bn_guard_t guard;
+  const uint8_t *hit;
+  const tdo_key_ctx_t *key = opts_->key;
+
+  if(opts_->cache == NULL)
+    return false;
+
+  hit = tdo_sig_cache_get(opts_->cache,key->id,digest_,key->size);
+  if(hit == NULL)
+    return false;
+
+  if(setjmp(guard.env) != 0)
+    return false;
+
+  mpSetFailHandler(bn_guard_fail,&guard);
+  ok = verify_digest(key,digest_,hit);
+  mpSetFailHandler(NULL,NULL);
+
+  if(!ok)
+    return false;
+
+  memcpy(sig_,hit,key->size);
+
+  return true;
+}
+
+static
+void
+sign_cache_put(const tdo_aif_sign_opts_t *opts_,
+               md5_digest_t               digest_,
+               const rsa_sig_t            sig_)
+{
+  if(opts_->cache == NULL)
+    return;
+
+  tdo_sig_cache_put(opts_->cache,opts_->key->id,digest_,sig_,opts_->key->size);
+}
+
+/*
+ * sign_md5_digests_guarded() for the digests not already in the
+ * signature cache, adding what it signs. The cache isn't thread safe
+ * so this is only called from the thread that owns opts_->cache.
+ */
+static
+int
+sign_md5_digests_cached(const tdo_aif_sign_opts_t *opts_,
+                        md5_digest_t              *digests_,
+                        rsa_sig_t                 *sigs_,
+                        size_t                     count_)
+{
+  int rv;
+  size_t nmiss;
+  size_t *miss;
+  rsa_sig_t *msigs;
+  md5_digest_t *mdigests;
+
+  if(opts_->cache == NULL)
+    return sign_md5_digests_guarded(opts_,digests_,sigs_,count_);
+
+  miss     = calloc(count_,sizeof(size_t));
+  msigs    = calloc(count_,sizeof(rsa_sig_t));
+  mdigests = calloc(count_,sizeof(md5_digest_t));
+  if((miss == NULL) || (msigs == NULL) || (mdigests == NULL))
+    {
+      free(mdigests);
+      free(msigs);
+      free(miss);
+      return sign_md5_digests_guarded(opts_,digests_,sigs_,count_);
+    }
+
+  nmiss = 0;
+  for(size_t i = 0; i < count_; i++)
+    {
+      if(sign_cache_get(opts_,digests_[i],sigs_[i]))
+        continue;
+      miss[nmiss] = i;
+      memcpy(mdigests[nmiss],digests_[i],sizeof(md5_digest_t));
+      nmiss++;
+    }
+
+  rv = sign_md5_digests_guarded(opts_,mdigests,msigs,nmiss);
+  for(size_t i = 0; (rv == 0) && (i < nmiss); i++)
+    {
+      memcpy(sigs_[miss[i]],msigs[i],opts_->key->size);
+      sign_cache_put(opts_,mdigests[i],msigs[i]);
+    }
+
+  free(mdigests);
+  free(msigs);
+  free(miss);
+
+  return rv;
 }
 
 static
@@ -87,48 +667,507 @@ end_of_buffer_0xFFFFFFFF(void   *buf_,
           (buf[offset + 3] == 0xFF));
 }
 
-int
-tdo_aif_sign(void       **buf_,
-             size_t      *size_,
-             const char  *key_)
+/*
+ * The header is patched in a private copy and the digest is taken
+ * over that copy followed by the untouched body. The caller's buffer
+ * is only modified by sign_finish() once the signature exists.
+ */
+typedef struct sign_job_s sign_job_t;
+struct sign_job_s
+{
+  size_t  size;
+  size_t  hdr_size;
+  uint8_t hdr[TDO_AIF_HEADER_SIZE];
+};
+
+static
+void
+sign_prepare(sign_job_t  *job_,
+             const void  *buf_,
+             size_t       size_,
+             md5_digest_t digest_)
 {
   size_t size;
-  char *buf;
-  rsa512_sig_t sig;
-  md5_digest_t digest;
+  size_t hdr_size;
+  uint32_t sig_size;
+  const uint8_t *buf;
+  md5_iov_t iov[2];
+
+  buf  = buf_;
+  size = size_;
 
-  buf  = *buf_;
-  size = *size_;
+  hdr_size = ((size < sizeof(job_->hdr)) ? size : sizeof(job_->hdr));
+  memcpy(job_->hdr,buf,hdr_size);
 
-  if(tdo_aif_has_sig(buf))
+  if(tdo_aif_has_sig(job_->hdr))
     {
       fprintf(stderr,"WARNING: file already has signature. Ignoring.\n");
-      size -= RSA512_SIG_SIZE;
-      tdo_aif_set_sig_size(buf,0);
+      sig_size = tdo_aif_get_sig_size(job_->hdr);
+      size -= ((sig_size < size) ? sig_size : size);
+      tdo_aif_set_sig_size(job_->hdr,0);
     }
 
-  if(!end_of_buffer_0xFFFFFFFF(buf,size))
+  if(!end_of_buffer_0xFFFFFFFF((void*)buf,size))
     fprintf(stderr,"WARNING: file doesn't appear to be an ARM executable. File last 4 bytes != 0xFF.\n");
 
-  tdo_aif_set_sig_offset(buf,size);
+  tdo_aif_set_sig_offset(job_->hdr,size);
 
-  calculate_md5(buf,size,digest);
+  if(hdr_size > size)
+    hdr_size = size;
 
-  sign_md5_digest(key_,digest,sig);
+  iov[0].base = job_->hdr;
+  iov[0].len  = hdr_size;
+  iov[1].base = &buf[hdr_size];
+  iov[1].len  = (size - hdr_size);
 
-  tdo_aif_set_sig_size(buf,RSA512_SIG_SIZE);
+  calculate_md5(iov,2,digest_);
 
-  buf = realloc(buf,(size+RSA512_SIG_SIZE));
+  job_->size     = size;
+  job_->hdr_size = hdr_size;
+}
+
+static
+int
+sign_finish(sign_job_t         *job_,
+            const rsa_sig_t     sig_,
+            size_t              sig_size_,
+            void              **buf_,
+            size_t             *size_)
+{
+  char *buf;
+
+  tdo_aif_set_sig_size(job_->hdr,sig_size_);
+
+  buf = realloc(*buf_,(job_->size + sig_size_));
   if(buf == NULL)
     {
       fprintf(stderr,"ERROR: failed to allocate memory - %s",strerror(errno));
       return -1;
     }
 
-  memcpy(&buf[size],sig,RSA512_SIG_SIZE);
+  memcpy(buf,job_->hdr,job_->hdr_size);
+  memcpy(&buf[job_->size],sig_,sig_size_);
 
   *buf_  = buf;
-  *size_ = size + RSA512_SIG_SIZE;
+  *size_ = (job_->size + sig_size_);
 
   return 0;
 }
+
+int
+tdo_aif_sign(void                      **buf_,
+             size_t                     *size_,
+             const tdo_aif_sign_opts_t  *opts_)
+{
+  sign_job_t job;
+  rsa_sig_t sig;
+  md5_digest_t digest;
+
+  sign_prepare(&job,*buf_,*size_,digest);
+  if(sign_md5_digests_cached(opts_,&digest,&sig,1) < 0)
+    return -1;
+
+  return sign_finish(&job,sig,opts_->key->size,buf_,size_);
+}
+
+int
+tdo_aif_sign_digest(const tdo_aif_sign_opts_t *opts_,
+                    md5_digest_t               digest_,
+                    uint8_t                    sig_[TDO_AIF_SIG_MAX_SIZE])
+{
+  return sign_md5_digests_guarded(opts_,(md5_digest_t*)digest_,(rsa_sig_t*)sig_,1);
+}
+
+int
+tdo_aif_sign_batch(tdo_aif_sign_item_t       *items_,
+                   size_t                     count_,
+                   const tdo_aif_sign_opts_t *opts_)
+{
+  int rv;
+  sign_job_t *jobs;
+  rsa_sig_t *sigs;
+  md5_digest_t *digests;
+
+  jobs    = calloc(count_,sizeof(sign_job_t));
+  sigs    = calloc(count_,sizeof(rsa_sig_t));
+  digests = calloc(count_,sizeof(md5_digest_t));
+  if((jobs == NULL) || (sigs == NULL) || (digests == NULL))
+    {
+      fprintf(stderr,"ERROR: failed to allocate memory - %s",strerror(errno));
+      free(digests);
+      free(sigs);
+      free(jobs);
+      return -1;
+    }
+
+  for(size_t i = 0; i < count_; i++)
+    sign_prepare(&jobs[i],
+                 items_[i].buf,
+                 items_[i].size,
+                 digests[i]);
+
+  rv = sign_md5_digests_cached(opts_,digests,sigs,count_);
+  for(size_t i = 0; i < count_; i++)
+    {
+      if(rv == 0)
+        items_[i].rv = sign_finish(&jobs[i],
+                                   sigs[i],
+                                   opts_->key->size,
+                                   &items_[i].buf,
+                                   &items_[i].size);
+      else
+        items_[i].rv = -1;
+    }
+  for(size_t i = 0; i < count_; i++)
+    {
+      if(items_[i].rv < 0)
+        rv = -1;
+    }
+
+  free(digests);
+  free(sigs);
+  free(jobs);
+
+  return rv;
+}
+
+typedef struct sign_keys_job_s sign_keys_job_t;
+struct sign_keys_job_s
+{
+  const tdo_aif_sign_opts_t  *opts;
+  const tdo_key_ctx_t *const *keys;
+  md5_digest_t                digest;
+  rsa_sig_t                  *sigs;
+  int                        *rv;
+  size_t                     *todo;
+};
+
+static
+void
+sign_keys_one(void   *job_,
+              size_t  idx_)
+{
+  size_t k;
+  tdo_aif_sign_opts_t opts;
+  sign_keys_job_t *job = job_;
+
+  k        = job->todo[idx_];
+  opts     = *job->opts;
+  opts.key = job->keys[k];
+
+  job->rv[k] = sign_md5_digests_guarded(&opts,&job->digest,&job->sigs[k],1);
+}
+
+static
+void
+sign_keys_done(void *job_)
+{
+  (void)job_;
+
+  tdo_aif_sign_release();
+}
+
+/*
+ * Sign one file with several keys. The digest doesn't depend on the
+ * key so the file is hashed once; the signatures are computed on up
+ * to one thread per key when there is more than one CPU. The cache is
+ * consulted and updated on the calling thread only. outs_[i]
+ * receives a new buffer signed with keys_[i] which the caller frees;
+ * its filepath is left alone. buf_ is not modified.
+ */
+int
+tdo_aif_sign_keys(const void                 *buf_,
+                  size_t                      size_,
+                  const tdo_aif_sign_opts_t  *opts_,
+                  const tdo_key_ctx_t *const *keys_,
+                  tdo_aif_sign_item_t        *outs_,
+                  size_t                      nkeys_)
+{
+  int rv;
+  size_t ntodo;
+  size_t nthreads;
+  sign_job_t job;
+  sign_keys_job_t kjob;
+  tdo_aif_sign_opts_t opts;
+  rsa_sig_t sigs[TDO_AIF_SIGN_MAX_KEYS];
+  int rvs[TDO_AIF_SIGN_MAX_KEYS];
+  size_t todo[TDO_AIF_SIGN_MAX_KEYS];
+
+  if(nkeys_ > TDO_AIF_SIGN_MAX_KEYS)
+    {
+      fprintf(stderr,"ERROR: can't sign with more than %d keys at once\n",
+              TDO_AIF_SIGN_MAX_KEYS);
+      return -1;
+    }
+
+  kjob.opts = opts_;
+  kjob.keys = keys_;
+  kjob.sigs = sigs;
+  kjob.rv   = rvs;
+  kjob.todo = todo;
+
+  sign_prepare(&job,buf_,size_,kjob.digest);
+
+  opts  = *opts_;
+  ntodo = 0;
+  for(size_t i = 0; i < nkeys_; i++)
+    {
+      opts.key = keys_[i];
+      rvs[i]   = 0;
+      if(!sign_cache_get(&opts,kjob.digest,sigs[i]))
+        todo[ntodo++] = i;
+    }
+
+  nthreads = parallel_ncpus();
+  parallel_for(((nthreads > 1) ? ntodo : 1),ntodo,sign_keys_one,sign_keys_done,&kjob);
+
+  for(size_t i = 0; i < ntodo; i++)
+    {
+      opts.key = keys_[todo[i]];
+      if(rvs[todo[i]] == 0)
+        sign_cache_put(&opts,kjob.digest,sigs[todo[i]]);
+    }
+
+  rv = 0;
+  for(size_t i = 0; i < nkeys_; i++)
+    {
+      outs_[i].buf  = NULL;
+      outs_[i].size = size_;
+      outs_[i].rv   = rvs[i];
+      if(rvs[i] == 0)
+        {
+          outs_[i].buf = malloc(size_);
+          if(outs_[i].buf == NULL)
+            {
+              fprintf(stderr,"ERROR: failed to allocate memory - %s",strerror(errno));
+              outs_[i].rv = -1;
+            }
+          else
+            {
+              memcpy(outs_[i].buf,buf_,size_);
+              outs_[i].rv = sign_finish(&job,
+                                        sigs[i],
+                                        keys_[i]->size,
+                                        &outs_[i].buf,
+                                        &outs_[i].size);
+            }
+        }
+      if(outs_[i].rv < 0)
+        rv = -1;
+    }
+
+  return rv;
+}
+
+/*
+ * msg = sig^e mod n, both key_->size octets. Returns -1 if the
+ * signature isn't below n.
+ */
+static
+int
+verify_recover(uint8_t             *msg_,
+               const uint8_t       *sig_,
+               const tdo_key_ctx_t *key_)
+{
+  int rv;
+  size_t mark;
+  sign_scratch_t *x;
+
+#if MPFW_AVAILABLE
+  if(key_->fw)
+    {
+      uint64_t s[MPFW512_LIMBS];
+      uint64_t v[MPFW512_LIMBS];
+      uint8_t n[TDO_KEYS_M1_RETAIL_MSG_SIZE];
+
+      mpfw512_to_octets(key_->nmont.n,n,sizeof(n));
+      if(memcmp(sig_,n,sizeof(n)) >= 0)
+        return -1;
+
+      mpfw512_from_octets(s,sig_,sizeof(n));
+      mpfw512_modexp_sched(v,s,&key_->fw_e,&key_->nmont);
+      mpfw512_to_octets(v,msg_,sizeof(n));
+
+      return 0;
+    }
+#endif
+
+  x    = sign_scratch();
+  mark = mpScratchBegin();
+
+  rv = -1;
+  bdConvFromOctets(x->s,sig_,key_->size);
+  if(bdCompare(x->s,key_->n) < 0)
+    {
+      bdModExp(x->v,x->s,key_->e,key_->n);
+      bdConvToOctets(x->v,msg_,key_->size);
+      rv = 0;
+    }
+
+  mpScratchEnd(mark);
+
+  return rv;
+}
+
+static
+bool
+verify_digest(const tdo_key_ctx_t *key_,
+              md5_digest_t         digest_,
+              const uint8_t       *sig_)
+{
+  uint8_t msg[TDO_KEYS_MSG_MAX_SIZE];
+  uint8_t expected[TDO_KEYS_MSG_MAX_SIZE];
+
+  if(verify_recover(msg,sig_,key_) < 0)
+    return false;
+
+  tdo_key_ctx_message(key_,digest_,expected);
+
+  return (memcmp(msg,expected,key_->size) == 0);
+}
+
+/*
+ * Items that verify get key_ recorded. Checking a signature alone
+ * costs about 17 multiplications with e = 65537, less than raising it
+ * to the random exponent a sound batch test would need, so each is
+ * checked by itself.
+ */
+static
+void
+verify_each(const tdo_key_ctx_t   *key_,
+            tdo_aif_verify_item_t *items_,
+            const size_t          *idx_,
+            size_t                 count_)
+{
+  for(size_t i = 0; i < count_; i++)
+    {
+      tdo_aif_verify_item_t *item = &items_[idx_[i]];
+
+      if(verify_digest(key_,item->digest,item->sig))
+        item->key = key_;
+    }
+}
+
+/*
+ * The digest covers [0,sig_offset) as it was when signed: with the
+ * header's signature size still zero.
+ */
+int
+tdo_aif_verify_prepare(const void            *buf_,
+                       size_t                 size_,
+                       const char            *filepath_,
+                       tdo_aif_verify_item_t *item_)
+{
+  size_t hdr_size;
+  uint32_t sig_size;
+  uint32_t sig_offset;
+  const uint8_t *buf;
+  md5_iov_t iov[2];
+  uint8_t hdr[TDO_AIF_HEADER_SIZE];
+
+  buf = buf_;
+
+  item_->key = NULL;
+
+  if(!tdo_aif_has_sig((void*)buf))
+    {
+      fprintf(stderr,"ERROR: file is not signed - %s\n",filepath_);
+      return -1;
+    }
+
+  sig_offset = tdo_aif_get_sig_offset((void*)buf);
+  sig_size   = tdo_aif_get_sig_size((void*)buf);
+  if((sig_size > TDO_AIF_SIG_MAX_SIZE) ||
+     (sig_offset > size_) ||
+     ((size_ - sig_offset) < sig_size))
+    {
+      fprintf(stderr,"ERROR: signature offset or size out of range - %s\n",filepath_);
+      return -1;
+    }
+
+  hdr_size = ((sig_offset < sizeof(hdr)) ? sig_offset : sizeof(hdr));
+  memcpy(hdr,buf,hdr_size);
+  tdo_aif_set_sig_size(hdr,0);
+
+  iov[0].base = hdr;
+  iov[0].len  = hdr_size;
+  iov[1].base = &buf[hdr_size];
+  iov[1].len  = (sig_offset - hdr_size);
+
+  calculate_md5(iov,2,item_->digest);
+  memcpy(item_->sig,&buf[sig_offset],sig_size);
+  item_->sig_size = sig_size;
+
+  return 0;
+}
+
+static
+int
+verify_each_guarded(const tdo_key_ctx_t   *key_,
+                    tdo_aif_verify_item_t *items_,
+                    size_t                *idx_,
+                    size_t                 count_)
+{
+  bn_guard_t guard;
+
+  if(setjmp(guard.env) != 0)
+    {
+      fprintf(stderr,"ERROR: verification failed - %s\n",guard.msg);
+      return -1;
+    }
+
+  mpSetFailHandler(bn_guard_fail,&guard);
+  verify_each(key_,items_,idx_,count_);
+  mpSetFailHandler(NULL,NULL);
+
+  return 0;
+}
+
+/*
+ * Keys are tried in order; whatever one leaves unmatched is checked
+ * against the next. Only signatures as long as a key's modulus are
+ * tried against it.
+ */
+int
+tdo_aif_verify_batch(tdo_aif_verify_item_t      *items_,
+                     size_t                      count_,
+                     const tdo_key_ctx_t *const *keys_,
+                     size_t                      nkeys_)
+{
+  int rv;
+  size_t *idx;
+
+  idx = calloc((count_ ? count_ : 1),sizeof(size_t));
+  if(idx == NULL)
+    {
+      fprintf(stderr,"ERROR: failed to allocate memory - %s",strerror(errno));
+      return -1;
+    }
+
+  for(size_t i = 0; i < nkeys_; i++)
+    {
+      size_t n;
+
+      n = 0;
+      for(size_t j = 0; j < count_; j++)
+        {
+          if((items_[j].key == NULL) &&
+             (items_[j].sig_size == keys_[i]->size))
+            idx[n++] = j;
+        }
+
+      if(verify_each_guarded(keys_[i],items_,idx,n) < 0)
+        break;
+    }
+
+  rv = 0;
+  for(size_t i = 0; i < count_; i++)
+    {
+      if(items_[i].key == NULL)
+        rv = -1;
+    }
+
+  free(idx);
+
+  return rv;
+}
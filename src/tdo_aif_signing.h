@@ -18,4 +18,67 @@
 
 #pragma once
 
-int tdo_aif_sign(void **buf, size_t *size, const char *key);
+#include "md5.h"
+#include "tdo_key_ctx.h"
+#include "tdo_keys.h"
+#include "tdo_sig_cache.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Signatures are as long as the key's modulus: 64 octets for retail */
+#define TDO_AIF_SIG_MAX_SIZE TDO_KEYS_MSG_MAX_SIZE
+/* Keys tdo_aif_sign_keys() accepts in one call */
+#define TDO_AIF_SIGN_MAX_KEYS 4
+
+typedef struct tdo_aif_sign_opts_s tdo_aif_sign_opts_t;
+struct tdo_aif_sign_opts_s
+{
+  const tdo_key_ctx_t *key;
+  bool                 constant_time;
+  bool                 blind;
+  tdo_sig_cache_t     *cache;
+};
+
+typedef struct tdo_aif_sign_item_s tdo_aif_sign_item_t;
+struct tdo_aif_sign_item_s
+{
+  void       *buf;
+  size_t      size;
+  const char *filepath;
+  int         rv;
+};
+
+int tdo_aif_sign(void **buf, size_t *size, const tdo_aif_sign_opts_t *opts);
+int tdo_aif_sign_digest(const tdo_aif_sign_opts_t *opts,
+                        md5_digest_t               digest,
+                        uint8_t                    sig[TDO_AIF_SIG_MAX_SIZE]);
+int tdo_aif_sign_batch(tdo_aif_sign_item_t       *items,
+                       size_t                     count,
+                       const tdo_aif_sign_opts_t *opts);
+int tdo_aif_sign_keys(const void                 *buf,
+                      size_t                      size,
+                      const tdo_aif_sign_opts_t  *opts,
+                      const tdo_key_ctx_t *const *keys,
+                      tdo_aif_sign_item_t        *outs,
+                      size_t                      nkeys);
+void tdo_aif_sign_release(void);
+
+typedef struct tdo_aif_verify_item_s tdo_aif_verify_item_t;
+struct tdo_aif_verify_item_s
+{
+  md5_digest_t         digest;
+  uint8_t              sig[TDO_AIF_SIG_MAX_SIZE];
+  uint32_t             sig_size;
+  const tdo_key_ctx_t *key;
+};
+
+int tdo_aif_verify_prepare(const void            *buf,
+                           size_t                 size,
+                           const char            *filepath,
+                           tdo_aif_verify_item_t *item);
+int tdo_aif_verify_batch(tdo_aif_verify_item_t      *items,
+                         size_t                      count,
+                         const tdo_key_ctx_t *const *keys,
+                         size_t                      nkeys);
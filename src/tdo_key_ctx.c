@@ -0,0 +1,453 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_key_ctx.h"
+
+#include "str.h"
+#include "tdo_keyfile.h"
+#include "tdo_keys.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TDO_KEY_CTX_CACHE_SIZE 4
+
+typedef struct tdo_key_ctx_slot_s tdo_key_ctx_slot_t;
+struct tdo_key_ctx_slot_s
+{
+  bool          used;
+  tdo_key_ctx_t ctx;
+};
+
+static tdo_key_ctx_slot_t g_cache[TDO_KEY_CTX_CACHE_SIZE];
+
+#if MPFW_AVAILABLE
+static
+void
+bd_to_fw256(uint64_t   r_[MPFW256_LIMBS],
+            const BIGD a_)
+{
+  uint8_t octets[MPFW256_LIMBS * 8];
+
+  bdConvToOctets(a_,octets,sizeof(octets));
+  mpfw256_from_octets(r_,octets,sizeof(octets));
+}
+
+static
+void
+bd_to_fw512(uint64_t   r_[MPFW512_LIMBS],
+            const BIGD a_)
+{
+  uint8_t octets[MPFW512_LIMBS * 8];
+
+  bdConvToOctets(a_,octets,sizeof(octets));
+  mpfw512_from_octets(r_,octets,sizeof(octets));
+}
+
+/* The exponents and qinv, once the Montgomery contexts are set */
+static
+void
+init_fw_exps(tdo_key_ctx_t  *ctx_,
+             const uint64_t  e_[MPFW512_LIMBS])
+{
+  mpfw4_256_mont_init(&ctx_->p4mont,&ctx_->pmont);
+  mpfw4_256_mont_init(&ctx_->q4mont,&ctx_->qmont);
+
+  mpfw_sched_init(&ctx_->fw_dp,ctx_->fw_dp_limbs,MPFW256_LIMBS);
+  mpfw_sched_init(&ctx_->fw_dq,ctx_->fw_dq_limbs,MPFW256_LIMBS);
+  mpfw_sched_init(&ctx_->fw_e,e_,MPFW512_LIMBS);
+}
+
+static
+bool
+init_fw(tdo_key_ctx_t *ctx_)
+{
+  uint64_t t[MPFW512_LIMBS];
+
+  if((bdBitLength(ctx_->n) != 512) ||
+     (bdBitLength(ctx_->p) != 256) ||
+     (bdBitLength(ctx_->q) != 256) ||
+     (bdBitLength(ctx_->e) > 512))
+    return false;
+
+  bd_to_fw256(t,ctx_->p);
+  if(mpfw256_mont_init(&ctx_->pmont,t) < 0)
+    return false;
+  bd_to_fw256(t,ctx_->q);
+  if(mpfw256_mont_init(&ctx_->qmont,t) < 0)
+    return false;
+  bd_to_fw512(t,ctx_->n);
+  if(mpfw512_mont_init(&ctx_->nmont,t) < 0)
+    return false;
+
+  bd_to_fw256(ctx_->fw_dp_limbs,ctx_->dp);
+  bd_to_fw256(ctx_->fw_dq_limbs,ctx_->dq);
+  bd_to_fw256(ctx_->fw_qinv,ctx_->qinv);
+  bd_to_fw512(t,ctx_->e);
+  init_fw_exps(ctx_,t);
+
+  return true;
+}
+
+#if (MPFW256_LIMBS != TDO_KEYS_CONST_P_LIMBS) || (MPFW512_LIMBS != TDO_KEYS_CONST_N_LIMBS)
+#error "tdo_keys_const_t limbs don't match mpfw"
+#endif
+
+/* Built-in keys: everything init_fw() computes was done at build time */
+static
+bool
+init_fw_const(tdo_key_ctx_t          *ctx_,
+              const tdo_keys_const_t *k_)
+{
+  if(((k_->n[MPFW512_LIMBS - 1] >> 63) == 0) ||
+     ((k_->p[MPFW256_LIMBS - 1] >> 63) == 0) ||
+     ((k_->q[MPFW256_LIMBS - 1] >> 63) == 0))
+    return false;
+
+  memcpy(ctx_->pmont.n,k_->p,sizeof(ctx_->pmont.n));
+  memcpy(ctx_->pmont.r2,k_->p_r2,sizeof(ctx_->pmont.r2));
+  ctx_->pmont.ninv = k_->p_ninv;
+  memcpy(ctx_->qmont.n,k_->q,sizeof(ctx_->qmont.n));
+  memcpy(ctx_->qmont.r2,k_->q_r2,sizeof(ctx_->qmont.r2));
+  ctx_->qmont.ninv = k_->q_ninv;
+  memcpy(ctx_->nmont.n,k_->n,sizeof(ctx_->nmont.n));
+  memcpy(ctx_->nmont.r2,k_->n_r2,sizeof(ctx_->nmont.r2));
+  ctx_->nmont.ninv = k_->n_ninv;
+
+  memcpy(ctx_->fw_dp_limbs,k_->dp,sizeof(ctx_->fw_dp_limbs));
+  memcpy(ctx_->fw_dq_limbs,k_->dq,sizeof(ctx_->fw_dq_limbs));
+  memcpy(ctx_->fw_qinv,k_->qinv,sizeof(ctx_->fw_qinv));
+  init_fw_exps(ctx_,k_->e);
+
+  return true;
+}
+#else
+static
+bool
+init_fw(tdo_key_ctx_t *ctx_)
+{
+  return false;
+}
+
+static
+bool
+init_fw_const(tdo_key_ctx_t          *ctx_,
+              const tdo_keys_const_t *k_)
+{
+  return false;
+}
+#endif
+
+/*
+ * Fill in whichever of dp, dq and qinv are missing and check the rest
+ * along with n = pq and e * d = 1 mod (p - 1) and (q - 1) so a bad key
+ * is refused before it produces signatures.
+ */
+static
+int
+derive_crt(tdo_key_ctx_t *ctx_)
+{
+  int rv;
+  BIGD t;
+  BIGD u;
+  BIGD v;
+
+  bdNewVars(&t,&u,&v,NULL);
+
+  rv = -1;
+
+  bdMultiply(t,ctx_->p,ctx_->q);
+  if(!bdIsEqual(t,ctx_->n))
+    {
+      fprintf(stderr,"ERROR: key %s: n != p * q\n",ctx_->name);
+      goto out;
+    }
+
+  bdShortSub(t,ctx_->p,1);
+  bdModulo(u,ctx_->d,t);
+  if(ctx_->dp == NULL)
+    ctx_->dp = bdNew();
+  else if(!bdIsEqual(u,ctx_->dp))
+    goto bad_crt;
+  bdSetEqual(ctx_->dp,u);
+  bdModMult(v,ctx_->e,ctx_->dp,t);
+  if(bdShortCmp(v,1) != 0)
+    goto bad_exp;
+
+  bdShortSub(t,ctx_->q,1);
+  bdModulo(u,ctx_->d,t);
+  if(ctx_->dq == NULL)
+    ctx_->dq = bdNew();
+  else if(!bdIsEqual(u,ctx_->dq))
+    goto bad_crt;
+  bdSetEqual(ctx_->dq,u);
+  bdModMult(v,ctx_->e,ctx_->dq,t);
+  if(bdShortCmp(v,1) != 0)
+    goto bad_exp;
+
+  if(bdModInv(u,ctx_->q,ctx_->p) != 0)
+    {
+      fprintf(stderr,"ERROR: key %s: q has no inverse mod p\n",ctx_->name);
+      goto out;
+    }
+  if(ctx_->qinv == NULL)
+    ctx_->qinv = bdNew();
+  else if(!bdIsEqual(u,ctx_->qinv))
+    goto bad_crt;
+  bdSetEqual(ctx_->qinv,u);
+
+  rv = 0;
+  goto out;
+
+ bad_crt:
+  fprintf(stderr,"ERROR: key %s: dp, dq or qinv doesn't match p, q and d\n",ctx_->name);
+  goto out;
+
+ bad_exp:
+  fprintf(stderr,"ERROR: key %s: d is not the inverse of e\n",ctx_->name);
+
+ out:
+  bdFreeVars(&t,&u,&v,NULL);
+
+  return rv;
+}
+
+/*
+ * Contexts are shared by signing threads. bigd only writes to an input
+ * when it has to grow it so give every value room for the largest
+ * calculation it is used in, those modulo n.
+ */
+static
+void
+reserve_bigds(tdo_key_ctx_t *ctx_)
+{
+  size_t ndigits;
+
+  ndigits = bdSizeof(ctx_->n);
+
+  bdReserve(ctx_->n,ndigits);
+  bdReserve(ctx_->d,ndigits);
+  bdReserve(ctx_->e,ndigits);
+  bdReserve(ctx_->p,ndigits);
+  bdReserve(ctx_->q,ndigits);
+  bdReserve(ctx_->dp,ndigits);
+  bdReserve(ctx_->dq,ndigits);
+  bdReserve(ctx_->qinv,ndigits);
+}
+
+static
+void
+init_id(tdo_key_ctx_t *ctx_)
+{
+  size_t esize;
+  md5_ctx_t md5;
+  uint8_t buf[TDO_KEYS_MSG_MAX_SIZE];
+
+  md5_init(&md5);
+  bdConvToOctets(ctx_->n,buf,ctx_->size);
+  md5_update(&md5,buf,ctx_->size);
+  esize = ((bdBitLength(ctx_->e) + 7) / 8);
+  if(esize > sizeof(buf))
+    esize = sizeof(buf);
+  bdConvToOctets(ctx_->e,buf,esize);
+  md5_update(&md5,buf,esize);
+  md5_finalize(&md5,ctx_->id);
+}
+
+static
+int
+finish_init(tdo_key_ctx_t *ctx_)
+{
+  if(derive_crt(ctx_) < 0)
+    {
+      tdo_key_ctx_free(ctx_);
+      return -1;
+    }
+
+  reserve_bigds(ctx_);
+  ctx_->size = ((bdBitLength(ctx_->n) + 7) / 8);
+  ctx_->fw   = init_fw(ctx_);
+  init_id(ctx_);
+
+  return 0;
+}
+
+/*
+ * The built-in keys were checked and their CRT and Montgomery
+ * constants derived when tdo_keys_const.cpp was compiled. The fixed
+ * width contexts are copied from those tables but the BIGDs for the
+ * generic path are still allocated and converted from the limbs here,
+ * eight small values once per key per process.
+ */
+int
+tdo_key_ctx_init(tdo_key_ctx_t *ctx_,
+                 const char    *key_)
+{
+  memset(ctx_,0,sizeof(*ctx_));
+
+  ctx_->name = key_;
+  ctx_->n    = tdo_keys_n(key_);
+  ctx_->d    = tdo_keys_d(key_);
+  ctx_->e    = tdo_keys_e(key_);
+  ctx_->p    = tdo_keys_p(key_);
+  ctx_->q    = tdo_keys_q(key_);
+  ctx_->dp   = tdo_keys_dp(key_);
+  ctx_->dq   = tdo_keys_dq(key_);
+  ctx_->qinv = tdo_keys_qinv(key_);
+  reserve_bigds(ctx_);
+  ctx_->size = ((bdBitLength(ctx_->n) + 7) / 8);
+  ctx_->fw   = init_fw_const(ctx_,tdo_keys_const(key_));
+  init_id(ctx_);
+
+  return 0;
+}
+
+/*
+ * Takes ownership of kf_'s values, which are freed on failure. name_
+ * is used in messages and must outlive the context.
+ */
+int
+tdo_key_ctx_init_keyfile(tdo_key_ctx_t *ctx_,
+                         const char    *name_,
+                         tdo_keyfile_t *kf_)
+{
+  memset(ctx_,0,sizeof(*ctx_));
+
+  if((bdBitLength(kf_->n) < TDO_KEY_CTX_MIN_BITS) ||
+     (bdBitLength(kf_->n) > TDO_KEY_CTX_MAX_BITS))
+    {
+      fprintf(stderr,
+              "ERROR: key %s: modulus must be %d to %d bits\n",
+              name_,
+              TDO_KEY_CTX_MIN_BITS,
+              TDO_KEY_CTX_MAX_BITS);
+      tdo_keyfile_free(kf_);
+      return -1;
+    }
+
+  ctx_->name = name_;
+  ctx_->n    = kf_->n;
+  ctx_->e    = kf_->e;
+  ctx_->d    = kf_->d;
+  ctx_->p    = kf_->p;
+  ctx_->q    = kf_->q;
+  ctx_->dp   = kf_->dp;
+  ctx_->dq   = kf_->dq;
+  ctx_->qinv = kf_->qinv;
+  memset(kf_,0,sizeof(*kf_));
+
+  return finish_init(ctx_);
+}
+
+int
+tdo_key_ctx_init_file(tdo_key_ctx_t *ctx_,
+                      const char    *filepath_)
+{
+  char *file;
+  tdo_keyfile_t kf;
+
+  memset(ctx_,0,sizeof(*ctx_));
+
+  if(tdo_keyfile_load(filepath_,&kf) < 0)
+    return -1;
+
+  file = strdup(filepath_);
+  if(tdo_key_ctx_init_keyfile(ctx_,file,&kf) < 0)
+    {
+      free(file);
+      return -1;
+    }
+
+  ctx_->file = file;
+
+  return 0;
+}
+
+/* msg_ receives ctx_->size octets */
+void
+tdo_key_ctx_message(const tdo_key_ctx_t *ctx_,
+                    md5_digest_t         digest_,
+                    uint8_t             *msg_)
+{
+  tdo_keys_pkcs1_md5_message_octets(digest_,msg_,ctx_->size);
+}
+
+void
+tdo_key_ctx_free(tdo_key_ctx_t *ctx_)
+{
+  bdFreeVars(&ctx_->n,&ctx_->d,&ctx_->e,&ctx_->p,&ctx_->q,
+             &ctx_->dp,&ctx_->dq,&ctx_->qinv,NULL);
+  free(ctx_->file);
+  memset(ctx_,0,sizeof(*ctx_));
+}
+
+/*
+ * Contexts are cached by name: a built-in key name or a key file
+ * path. Built-in names are only matched against built-in contexts so a
+ * file called "app" doesn't alias the retail key.
+ */
+static
+const
+tdo_key_ctx_t*
+key_ctx_cached(const char  *name_,
+               bool         file_,
+               int        (*init_)(tdo_key_ctx_t*,const char*))
+{
+  tdo_key_ctx_slot_t *slot;
+
+  slot = NULL;
+  for(size_t i = 0; i < TDO_KEY_CTX_CACHE_SIZE; i++)
+    {
+      if(!g_cache[i].used)
+        {
+          if(slot == NULL)
+            slot = &g_cache[i];
+          continue;
+        }
+      if(((g_cache[i].ctx.file != NULL) == file_) &&
+         streq(g_cache[i].ctx.name,name_))
+        return &g_cache[i].ctx;
+    }
+
+  if(slot == NULL)
+    {
+      fprintf(stderr,"ERROR: key context cache full\n");
+      return NULL;
+    }
+
+  if(init_(&slot->ctx,name_) < 0)
+    return NULL;
+  slot->used = true;
+
+  return &slot->ctx;
+}
+
+const
+tdo_key_ctx_t*
+tdo_key_ctx_get(const char *key_)
+{
+  return key_ctx_cached(key_,false,tdo_key_ctx_init);
+}
+
+const
+tdo_key_ctx_t*
+tdo_key_ctx_get_file(const char *filepath_)
+{
+  return key_ctx_cached(filepath_,true,tdo_key_ctx_init_file);
+}
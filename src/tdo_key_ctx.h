@@ -0,0 +1,89 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "bigd.h"
+#include "md5.h"
+#include "mpfw.h"
+#include "mpfw4.h"
+#include "tdo_keyfile.h"
+#include "tdo_keys.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TDO_KEY_CTX_MIN_BITS 512
+#define TDO_KEY_CTX_MAX_BITS (TDO_KEYS_MSG_MAX_SIZE * 8)
+#define TDO_KEY_CTX_ID_SIZE 16
+
+/*
+ * Everything signing needs from a key, parsed and derived once: the
+ * bigd values for the generic path plus CRT exponents and Montgomery
+ * constants for the fixed width backend when the key fits it. size is
+ * the modulus length in octets, which is also the length of messages
+ * and signatures. id is the MD5 of the public key, n then e.
+ */
+typedef struct tdo_key_ctx_s tdo_key_ctx_t;
+struct tdo_key_ctx_s
+{
+  const char *name;
+  char *file;
+  BIGD n;
+  BIGD d;
+  BIGD e;
+  BIGD p;
+  BIGD q;
+  BIGD dp;
+  BIGD dq;
+  BIGD qinv;
+  size_t size;
+  uint8_t id[TDO_KEY_CTX_ID_SIZE];
+  bool fw;
+#if MPFW_AVAILABLE
+  mpfw256_mont_t pmont;
+  mpfw256_mont_t qmont;
+  mpfw512_mont_t nmont;
+  mpfw4_256_mont_t p4mont;
+  mpfw4_256_mont_t q4mont;
+  mpfw_sched_t fw_dp;
+  mpfw_sched_t fw_dq;
+  mpfw_sched_t fw_e;
+  uint64_t fw_dp_limbs[MPFW256_LIMBS];
+  uint64_t fw_dq_limbs[MPFW256_LIMBS];
+  uint64_t fw_qinv[MPFW256_LIMBS];
+#endif
+};
+
+/*
+ * tdo_key_ctx_get() and tdo_key_ctx_get_file() fill a process wide
+ * cache without locking: get every key before starting threads. The
+ * contexts are only read while signing and may then be shared.
+ */
+int  tdo_key_ctx_init(tdo_key_ctx_t *ctx, const char *key);
+int  tdo_key_ctx_init_file(tdo_key_ctx_t *ctx, const char *filepath);
+int  tdo_key_ctx_init_keyfile(tdo_key_ctx_t *ctx, const char *name, tdo_keyfile_t *kf);
+void tdo_key_ctx_free(tdo_key_ctx_t *ctx);
+
+const tdo_key_ctx_t *tdo_key_ctx_get(const char *key);
+const tdo_key_ctx_t *tdo_key_ctx_get_file(const char *filepath);
+
+void tdo_key_ctx_message(const tdo_key_ctx_t *ctx,
+                         md5_digest_t         digest,
+                         uint8_t             *msg);
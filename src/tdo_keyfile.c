@@ -0,0 +1,273 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_keyfile.h"
+
+#include "bigd.h"
+#include "fileio.h"
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TDO_KEYFILE_MAGIC "MBK\1"
+#define TDO_KEYFILE_MAGIC_SIZE 4
+
+typedef struct keyfile_field_s keyfile_field_t;
+struct keyfile_field_s
+{
+  const char *name;
+  size_t      offset;
+  bool        required;
+};
+
+static const keyfile_field_t FIELDS[] =
+  {
+   {"n",    offsetof(tdo_keyfile_t,n),    true},
+   {"e",    offsetof(tdo_keyfile_t,e),    true},
+   {"d",    offsetof(tdo_keyfile_t,d),    true},
+   {"p",    offsetof(tdo_keyfile_t,p),    true},
+   {"q",    offsetof(tdo_keyfile_t,q),    true},
+   {"dp",   offsetof(tdo_keyfile_t,dp),   false},
+   {"dq",   offsetof(tdo_keyfile_t,dq),   false},
+   {"qinv", offsetof(tdo_keyfile_t,qinv), false},
+   {NULL}
+  };
+
+static
+BIGD*
+field_ptr(tdo_keyfile_t         *kf_,
+          const keyfile_field_t *field_)
+{
+  return (BIGD*)((char*)kf_ + field_->offset);
+}
+
+static
+int
+load_binary(const char    *filepath_,
+            const uint8_t *buf_,
+            size_t         size_,
+            tdo_keyfile_t *kf_)
+{
+  size_t off;
+
+  off = TDO_KEYFILE_MAGIC_SIZE;
+  for(const keyfile_field_t *f = FIELDS; f->name != NULL; f++)
+    {
+      size_t len;
+
+      if((size_ - off) < 2)
+        goto truncated;
+      len  = ((buf_[off] << 8) | buf_[off + 1]);
+      off += 2;
+      if((size_ - off) < len)
+        goto truncated;
+
+      if(len > 0)
+        {
+          *field_ptr(kf_,f) = bdNew();
+          bdConvFromOctets(*field_ptr(kf_,f),&buf_[off],len);
+        }
+      off += len;
+    }
+
+  return 0;
+
+ truncated:
+  fprintf(stderr,"ERROR: key file truncated - %s\n",filepath_);
+  return -1;
+}
+
+static
+int
+load_text(const char    *filepath_,
+          const char    *buf_,
+          size_t         size_,
+          tdo_keyfile_t *kf_)
+{
+  size_t off;
+  unsigned line;
+
+  off  = 0;
+  line = 0;
+  while(off < size_)
+    {
+      size_t end;
+      size_t name;
+      size_t namelen;
+      size_t hex;
+      size_t hexlen;
+      char *str;
+      const keyfile_field_t *f;
+
+      line++;
+      for(end = off; (end < size_) && (buf_[end] != '\n'); end++)
+        ;
+
+      while((off < end) && isspace((unsigned char)buf_[off]))
+        off++;
+      if((off == end) || (buf_[off] == '#'))
+        {
+          off = (end + 1);
+          continue;
+        }
+
+      name = off;
+      while((off < end) && isalpha((unsigned char)buf_[off]))
+        off++;
+      namelen = (off - name);
+
+      while((off < end) && isspace((unsigned char)buf_[off]))
+        off++;
+      if((off == end) || (buf_[off] != '='))
+        goto malformed;
+      off++;
+      while((off < end) && isspace((unsigned char)buf_[off]))
+        off++;
+
+      hex = off;
+      while((off < end) && isxdigit((unsigned char)buf_[off]))
+        off++;
+      hexlen = (off - hex);
+      while((off < end) && isspace((unsigned char)buf_[off]))
+        off++;
+      if((hexlen == 0) || (off != end))
+        goto malformed;
+
+      for(f = FIELDS; f->name != NULL; f++)
+        {
+          if((strlen(f->name) == namelen) && !memcmp(f->name,&buf_[name],namelen))
+            break;
+        }
+      if(f->name == NULL)
+        {
+          fprintf(stderr,"ERROR: %s:%u: unknown key value '%.*s'\n",
+                  filepath_,line,(int)namelen,&buf_[name]);
+          return -1;
+        }
+      if(*field_ptr(kf_,f) != NULL)
+        {
+          fprintf(stderr,"ERROR: %s:%u: '%s' given twice\n",filepath_,line,f->name);
+          return -1;
+        }
+
+      str = malloc(hexlen + 1);
+      if(str == NULL)
+        return -1;
+      memcpy(str,&buf_[hex],hexlen);
+      str[hexlen] = '\0';
+      *field_ptr(kf_,f) = bdNew();
+      bdConvFromHex(*field_ptr(kf_,f),str);
+      free(str);
+
+      off = (end + 1);
+    }
+
+  return 0;
+
+ malformed:
+  fprintf(stderr,"ERROR: %s:%u: expected 'name = HEX'\n",filepath_,line);
+  return -1;
+}
+
+int
+tdo_keyfile_load(const char    *filepath_,
+                 tdo_keyfile_t *kf_)
+{
+  int rv;
+  size_t size;
+  const char *buf;
+
+  memset(kf_,0,sizeof(*kf_));
+
+  buf = fileio_map(filepath_,&size);
+  if(buf == NULL)
+    return -1;
+
+  if((size >= TDO_KEYFILE_MAGIC_SIZE) &&
+     !memcmp(buf,TDO_KEYFILE_MAGIC,TDO_KEYFILE_MAGIC_SIZE))
+    rv = load_binary(filepath_,(const uint8_t*)buf,size,kf_);
+  else
+    rv = load_text(filepath_,buf,size,kf_);
+
+  fileio_unmap(buf,size);
+
+  for(const keyfile_field_t *f = FIELDS; (rv == 0) && (f->name != NULL); f++)
+    {
+      if(f->required && (*field_ptr(kf_,f) == NULL))
+        {
+          fprintf(stderr,"ERROR: key file is missing '%s' - %s\n",f->name,filepath_);
+          rv = -1;
+        }
+    }
+
+  if(rv < 0)
+    tdo_keyfile_free(kf_);
+
+  return rv;
+}
+
+/*
+ * Writes kf_ in the text format, every field present, or to stdout if
+ * filepath_ is NULL. A file is only readable by its owner.
+ */
+int
+tdo_keyfile_save(const char          *filepath_,
+                 const tdo_keyfile_t *kf_)
+{
+  int rv;
+  char *buf;
+  size_t off;
+  size_t size;
+
+  size = 64;
+  for(const keyfile_field_t *f = FIELDS; f->name != NULL; f++)
+    size += (strlen(f->name) + bdConvToHex(*field_ptr((tdo_keyfile_t*)kf_,f),NULL,0) + 5);
+
+  buf = malloc(size);
+  if(buf == NULL)
+    return -1;
+
+  off = snprintf(buf,size,"# RSA key, %zu bits\n",bdBitLength(kf_->n));
+  for(const keyfile_field_t *f = FIELDS; f->name != NULL; f++)
+    {
+      off += snprintf(&buf[off],size - off,"%s = ",f->name);
+      off += bdConvToHex(*field_ptr((tdo_keyfile_t*)kf_,f),&buf[off],size - off);
+      off += snprintf(&buf[off],size - off,"\n");
+    }
+
+  if(filepath_ == NULL)
+    rv = ((fwrite(buf,1,off,stdout) == off) ? 0 : -1);
+  else
+    rv = fileio_write_private(filepath_,buf,off);
+
+  free(buf);
+
+  return rv;
+}
+
+void
+tdo_keyfile_free(tdo_keyfile_t *kf_)
+{
+  for(const keyfile_field_t *f = FIELDS; f->name != NULL; f++)
+    bdFree(field_ptr(kf_,f));
+}
@@ -0,0 +1,50 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * External RSA signing keys. Two formats are accepted:
+ *
+ * text: one "name = HEX" per line for n, e, d, p, q and optionally
+ *       dp, dq and qinv. Blank lines and lines starting with '#' are
+ *       ignored.
+ * binary: the 4 byte magic "MBK\1" followed by n, e, d, p, q, dp, dq
+ *         and qinv in that order, each as a 16-bit big-endian length
+ *         and that many big-endian bytes. A zero length leaves the
+ *         CRT values to be derived.
+ */
+
+#pragma once
+
+#include "bigd.h"
+
+typedef struct tdo_keyfile_s tdo_keyfile_t;
+struct tdo_keyfile_s
+{
+  BIGD n;
+  BIGD e;
+  BIGD d;
+  BIGD p;
+  BIGD q;
+  BIGD dp;
+  BIGD dq;
+  BIGD qinv;
+};
+
+int  tdo_keyfile_load(const char *filepath, tdo_keyfile_t *kf);
+int  tdo_keyfile_save(const char *filepath, const tdo_keyfile_t *kf);
+void tdo_keyfile_free(tdo_keyfile_t *kf);
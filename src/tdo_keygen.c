@@ -0,0 +1,179 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "tdo_keygen.h"
+
+#include "bigd.h"
+#include "bigdigits.h"
+#include "parallel.h"
+#include "rng.h"
+#include "tdo_key_ctx.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define KEYGEN_PRIME_TRIES 8
+
+typedef struct keygen_job_s keygen_job_t;
+struct keygen_job_s
+{
+  BIGD     primes[2];
+  unsigned bits[2];
+  int      rv[2];
+};
+
+static
+int
+keygen_rand(unsigned char       *buf_,
+            size_t               nbytes_,
+            const unsigned char *seed_,
+            size_t               seedlen_)
+{
+  (void)seed_;
+  (void)seedlen_;
+
+  return rng_bytes(buf_,nbytes_);
+}
+
+/*
+ * Rabin-Miller rounds for a random candidate of bits_ bits to be
+ * composite with probability below 2^-100, per FIPS 186-4 table C.3
+ * and HAC table 4.4. Composites almost always fail the first round so
+ * this is mostly the cost of confirming the prime that is found.
+ */
+static
+size_t
+keygen_rm_tests(unsigned bits_)
+{
+  if(bits_ >= 1536)
+    return 4;
+  if(bits_ >= 1024)
+    return 5;
+  if(bits_ >= 512)
+    return 8;
+  return 16;
+}
+
+/*
+ * A prime of the requested size for which e is a valid exponent:
+ * since e is prime that only needs p - 1 not to be a multiple of it.
+ */
+static
+void
+keygen_prime(void   *job_,
+             size_t  idx_)
+{
+  BIGD r;
+  keygen_job_t *job = job_;
+
+  r = bdNew();
+  job->rv[idx_] = -1;
+  for(int i = 0; i < KEYGEN_PRIME_TRIES; i++)
+    {
+      if(bdGeneratePrime(job->primes[idx_],job->bits[idx_],
+                         keygen_rm_tests(job->bits[idx_]),
+                         NULL,0,keygen_rand) != 0)
+        continue;
+      if(bdShortMod(r,job->primes[idx_],TDO_KEYGEN_E) == 1)
+        continue;
+
+      job->rv[idx_] = 0;
+      break;
+    }
+  bdFree(&r);
+}
+
+static
+void
+keygen_done(void *job_)
+{
+  (void)job_;
+
+  mpScratchRelease();
+}
+
+/*
+ * Generates an RSA key of bits bits with e = 65537 and fills in every
+ * field of kf_ including the CRT values. p and q are searched for on
+ * separate threads. kf_ is zeroed first and must be released with
+ * tdo_keyfile_free() whether or not this succeeds.
+ */
+int
+tdo_keygen(tdo_keyfile_t *kf_,
+           unsigned       bits_)
+{
+  int rv;
+  BIGD p1;
+  BIGD q1;
+  BIGD phi;
+  keygen_job_t job;
+
+  memset(kf_,0,sizeof(*kf_));
+
+  if((bits_ < TDO_KEY_CTX_MIN_BITS) || (bits_ > TDO_KEY_CTX_MAX_BITS))
+    {
+      fprintf(stderr,
+              "ERROR: key size must be %d to %d bits\n",
+              TDO_KEY_CTX_MIN_BITS,
+              TDO_KEY_CTX_MAX_BITS);
+      return -1;
+    }
+
+  bdNewVars(&kf_->n,&kf_->e,&kf_->d,&kf_->p,&kf_->q,
+            &kf_->dp,&kf_->dq,&kf_->qinv,NULL);
+  bdNewVars(&p1,&q1,&phi,NULL);
+
+  memset(&job,0,sizeof(job));
+  job.primes[0] = kf_->p;
+  job.primes[1] = kf_->q;
+  job.bits[0]   = ((bits_ + 1) / 2);
+  job.bits[1]   = (bits_ / 2);
+
+  rv = -1;
+  do
+    {
+      parallel_for(2,2,keygen_prime,keygen_done,&job);
+      if((job.rv[0] < 0) || (job.rv[1] < 0))
+        {
+          fprintf(stderr,"ERROR: unable to find primes for a %u bit key\n",bits_);
+          goto out;
+        }
+    } while(bdIsEqual(kf_->p,kf_->q));
+
+  bdSetShort(kf_->e,TDO_KEYGEN_E);
+  bdMultiply(kf_->n,kf_->p,kf_->q);
+
+  bdShortSub(p1,kf_->p,1);
+  bdShortSub(q1,kf_->q,1);
+  bdMultiply(phi,p1,q1);
+  if((bdModInv(kf_->d,kf_->e,phi) != 0) ||
+     (bdModInv(kf_->qinv,kf_->q,kf_->p) != 0))
+    {
+      fprintf(stderr,"ERROR: generated key has no private exponent\n");
+      goto out;
+    }
+  bdModulo(kf_->dp,kf_->d,p1);
+  bdModulo(kf_->dq,kf_->d,q1);
+
+  rv = 0;
+
+ out:
+  bdFreeVars(&p1,&q1,&phi,NULL);
+
+  return rv;
+}
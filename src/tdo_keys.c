@@ -18,79 +18,136 @@
 
 #define HAVE_C99INCLUDES
 
+#include "tdo_keys.h"
+
 #include "bigd.h"
 #include "md5.h"
 #include "str.h"
+#include "tdo_keys_const.h"
 
 #include <assert.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
-static const char M1_RETAIL_3DO_N_STR[] = "B19462B00D8D6E1EC909AB385E06FE034BFD282E9FFDC584838C15F12593DD1E3A8B5626F1B9D0ED0C384EF6C5D14512BD72DDB85B44080E0472C03D0AFC4C97";
-static const char M1_RETAIL_3DO_D_STR[] = "42F7CD9BCD109805BE150A60107D9C8F8BB9A5CCA78361588EEF665AF1ABE887DBC2593D0868F364A93C8CB8CC6F4BCC6A3DE57E04B17AC52F2649939C453F61";
-static const char M1_RETAIL_3DO_P_STR[] = "E1BE29DE79315A1CD384C61DB3BACA5227C2D5A2020899283328C8E9C9B53BB1";
-static const char M1_RETAIL_3DO_Q_STR[] = "C9619D5BBAEB0DEBCC6D144E380C987108C33FA379BB0CE1F714A7E92DF0C6C7";
-static const char M1_RETAIL_3DO_E_STR[] = "10001";
-
-static const char M1_RETAIL_APP_N_STR[] = "BC0B199086C7F26CBC9D50F404944DB4789FCBFCF7AD8DBC2120898ABEAAF311EEA20229035608841FA41073ABBD5D37500C60B53BFB46605740381B72C9DB71";
-static const char M1_RETAIL_APP_D_STR[] = "18B2207E61A51ACA7B0EF215CA102C105A9329F824130FFD38208CCFC2F0B2915B8AD1E7772334381737D232B183C869C34940BC8769C97E18D7B0E78C492991";
-static const char M1_RETAIL_APP_P_STR[] = "CBBA701095E52D2D96F4153328F7B85D147D273D1033AE034721F1B09A96FED5";
-static const char M1_RETAIL_APP_Q_STR[] = "EC4A6C856F69EA7F910C4327E4586DCFAEC8C6E7AC875A435AD6EDB7476AD02D";
-static const char M1_RETAIL_APP_E_STR[] = "10001";
-
-static const char M1_RETAIL_MSG_PREFIX_STR[] = "1ffffffffffffffffffffffffffffffffffffffffffffffffffffff003020300c06082a864886f70d020505000410";
-
+/* DER DigestInfo header for MD5, followed in the message by the digest */
+static const uint8_t MD5_DIGEST_INFO[] =
+  {
+    0x30,0x20,0x30,0x0C,0x06,0x08,0x2A,0x86,0x48,0x86,0xF7,0x0D,0x02,0x05,0x05,0x00,
+    0x04,0x10
+  };
 
+/*
+ * limbs_ is nlimbs_ little-endian 64-bit words. The BIGD is a new
+ * allocation: bigd owns and may grow its digits and its digit width
+ * depends on the build, so it can't point into the const tables.
+ */
 static
 BIGD
-bigd_from_hex_str(const char *s_)
+bigd_from_limbs(const uint64_t *limbs_,
+                size_t          nlimbs_)
 {
   BIGD bigd;
+  size_t len;
+  uint8_t octets[TDO_KEYS_CONST_N_LIMBS * 8];
+
+  assert(nlimbs_ <= TDO_KEYS_CONST_N_LIMBS);
+
+  len = (nlimbs_ * 8);
+  for(size_t i = 0; i < len; i++)
+    octets[len - 1 - i] = (limbs_[i / 8] >> (8 * (i % 8)));
 
   bigd = bdNew();
 
-  bdConvFromHex(bigd,s_);
+  bdConvFromOctets(bigd,octets,len);
 
   return bigd;
 }
 
+#define BIGD_FROM_LIMBS(L) bigd_from_limbs((L),(sizeof(L) / sizeof((L)[0])))
+
 BIGD
 tdo_keys_m1_retail_3do_n(void)
 {
-  return bigd_from_hex_str(M1_RETAIL_3DO_N_STR);
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_3DO.n);
 }
 
 BIGD
 tdo_keys_m1_retail_3do_d(void)
 {
-  return bigd_from_hex_str(M1_RETAIL_3DO_D_STR);
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_3DO.d);
+}
+
+BIGD
+tdo_keys_m1_retail_3do_p(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_3DO.p);
+}
+
+BIGD
+tdo_keys_m1_retail_3do_q(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_3DO.q);
+}
+
+BIGD
+tdo_keys_m1_retail_3do_e(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_3DO.e);
 }
 
 BIGD
 tdo_keys_m1_retail_app_n(void)
 {
-  return bigd_from_hex_str(M1_RETAIL_APP_N_STR);
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_APP.n);
 }
 
 BIGD
 tdo_keys_m1_retail_app_d(void)
 {
-  return bigd_from_hex_str(M1_RETAIL_APP_D_STR);
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_APP.d);
+}
+
+BIGD
+tdo_keys_m1_retail_app_p(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_APP.p);
+}
+
+BIGD
+tdo_keys_m1_retail_app_q(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_APP.q);
 }
 
 BIGD
-tdo_keys_m1_retail_message(md5_digest_t digest_)
+tdo_keys_m1_retail_app_e(void)
+{
+  return BIGD_FROM_LIMBS(TDO_KEYS_M1_RETAIL_APP.e);
+}
+
+/*
+ * EMSA-PKCS1-v1_5: 00 01 FF..FF 00 || DigestInfo(MD5) || digest padded
+ * out to len_ octets, the modulus length.
+ */
+void
+tdo_keys_pkcs1_md5_message_octets(md5_digest_t  digest_,
+                                  uint8_t      *msg_,
+                                  size_t        len_)
 {
-  char str[128];
+  size_t pad;
+
+  assert(len_ >= TDO_KEYS_MSG_MIN_SIZE);
+  assert(len_ <= TDO_KEYS_MSG_MAX_SIZE);
 
-  sprintf(str,
-          "%s%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x%02x",
-          M1_RETAIL_MSG_PREFIX_STR,
-          digest_[0x0],digest_[0x1],digest_[0x2],digest_[0x3],
-          digest_[0x4],digest_[0x5],digest_[0x6],digest_[0x7],
-          digest_[0x8],digest_[0x9],digest_[0xA],digest_[0xB],
-          digest_[0xC],digest_[0xD],digest_[0xE],digest_[0xF]);
+  pad = (len_ - 3 - sizeof(MD5_DIGEST_INFO) - sizeof(md5_digest_t));
 
-  return bigd_from_hex_str(str);
+  msg_[0] = 0x00;
+  msg_[1] = 0x01;
+  memset(&msg_[2],0xFF,pad);
+  msg_[2 + pad] = 0x00;
+  memcpy(&msg_[3 + pad],MD5_DIGEST_INFO,sizeof(MD5_DIGEST_INFO));
+  memcpy(&msg_[len_ - sizeof(md5_digest_t)],digest_,sizeof(md5_digest_t));
 }
 
 BIGD
@@ -114,12 +171,61 @@ tdo_keys_d(const char *key_)
 }
 
 BIGD
-tdo_keys_m(const char   *key_,
-           md5_digest_t  digest_)
+tdo_keys_p(const char *key_)
 {
   if(streq(key_,"3do"))
-    return tdo_keys_m1_retail_message(digest_);
+    return tdo_keys_m1_retail_3do_p();
   if(streq(key_,"app"))
-    return tdo_keys_m1_retail_message(digest_);
+    return tdo_keys_m1_retail_app_p();
   assert(false);
 }
+
+BIGD
+tdo_keys_q(const char *key_)
+{
+  if(streq(key_,"3do"))
+    return tdo_keys_m1_retail_3do_q();
+  if(streq(key_,"app"))
+    return tdo_keys_m1_retail_app_q();
+  assert(false);
+}
+
+BIGD
+tdo_keys_e(const char *key_)
+{
+  if(streq(key_,"3do"))
+    return tdo_keys_m1_retail_3do_e();
+  if(streq(key_,"app"))
+    return tdo_keys_m1_retail_app_e();
+  assert(false);
+}
+
+const
+tdo_keys_const_t*
+tdo_keys_const(const char *key_)
+{
+  if(streq(key_,"3do"))
+    return &TDO_KEYS_M1_RETAIL_3DO;
+  if(streq(key_,"app"))
+    return &TDO_KEYS_M1_RETAIL_APP;
+  assert(false);
+  return NULL;
+}
+
+BIGD
+tdo_keys_dp(const char *key_)
+{
+  return BIGD_FROM_LIMBS(tdo_keys_const(key_)->dp);
+}
+
+BIGD
+tdo_keys_dq(const char *key_)
+{
+  return BIGD_FROM_LIMBS(tdo_keys_const(key_)->dq);
+}
+
+BIGD
+tdo_keys_qinv(const char *key_)
+{
+  return BIGD_FROM_LIMBS(tdo_keys_const(key_)->qinv);
+}
@@ -20,14 +20,37 @@
 
 #include "bigd.h"
 #include "md5.h"
+#include "tdo_keys_const.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TDO_KEYS_M1_RETAIL_MSG_SIZE 64
+/* PKCS#1 needs 8 octets of padding around the 34 octet MD5 DigestInfo */
+#define TDO_KEYS_MSG_MIN_SIZE       45
+#define TDO_KEYS_MSG_MAX_SIZE       512
 
 BIGD tdo_keys_m1_retail_3do_n(void);
 BIGD tdo_keys_m1_retail_3do_d(void);
+BIGD tdo_keys_m1_retail_3do_p(void);
+BIGD tdo_keys_m1_retail_3do_q(void);
+BIGD tdo_keys_m1_retail_3do_e(void);
 BIGD tdo_keys_m1_retail_app_n(void);
 BIGD tdo_keys_m1_retail_app_d(void);
+BIGD tdo_keys_m1_retail_app_p(void);
+BIGD tdo_keys_m1_retail_app_q(void);
+BIGD tdo_keys_m1_retail_app_e(void);
 
-BIGD tdo_keys_m1_retail_message(md5_digest_t digest);
+void tdo_keys_pkcs1_md5_message_octets(md5_digest_t  digest,
+                                       uint8_t      *msg,
+                                       size_t        len);
 
 BIGD tdo_keys_n(const char *key);
 BIGD tdo_keys_d(const char *key);
-BIGD tdo_keys_m(const char *key, md5_digest_t digest);
+BIGD tdo_keys_p(const char *key);
+BIGD tdo_keys_q(const char *key);
+BIGD tdo_keys_e(const char *key);
+BIGD tdo_keys_dp(const char *key);
+BIGD tdo_keys_dq(const char *key);
+BIGD tdo_keys_qinv(const char *key);
+const tdo_keys_const_t *tdo_keys_const(const char *key);
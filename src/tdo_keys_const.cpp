@@ -0,0 +1,451 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * The retail keys, parsed and expanded by the compiler. Everything
+ * here is constexpr so the tables land in read-only data with no
+ * runtime initialisation, and a key that doesn't check out (n != pq,
+ * d not an inverse of e, ...) is a compile error rather than a bad
+ * signature.
+ */
+
+#include "tdo_keys_const.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define N_LIMBS TDO_KEYS_CONST_N_LIMBS
+#define P_LIMBS TDO_KEYS_CONST_P_LIMBS
+
+namespace
+{
+  template<size_t N>
+  struct limbs_t
+  {
+    uint64_t v[N];
+  };
+
+  template<size_t N>
+  constexpr
+  limbs_t<N>
+  from_hex(const char *s_)
+  {
+    size_t len = 0;
+    limbs_t<N> r{};
+
+    while(s_[len] != '\0')
+      len++;
+    if(len > (N * 16))
+      throw "hex string too long";
+
+    for(size_t i = 0; i < len; i++)
+      {
+        uint64_t x = 0;
+        char c = s_[len - 1 - i];
+
+        if((c >= '0') && (c <= '9'))
+          x = (c - '0');
+        else if((c >= 'A') && (c <= 'F'))
+          x = (c - 'A' + 10);
+        else if((c >= 'a') && (c <= 'f'))
+          x = (c - 'a' + 10);
+        else
+          throw "bad hex digit";
+
+        r.v[i / 16] |= (x << (4 * (i % 16)));
+      }
+
+    return r;
+  }
+
+  template<size_t N>
+  constexpr
+  limbs_t<N>
+  from_u64(uint64_t a_)
+  {
+    limbs_t<N> r{};
+
+    r.v[0] = a_;
+
+    return r;
+  }
+
+  template<size_t N>
+  constexpr
+  bool
+  is_u64(const limbs_t<N> &a_,
+         uint64_t          b_)
+  {
+    if(a_.v[0] != b_)
+      return false;
+    for(size_t i = 1; i < N; i++)
+      if(a_.v[i] != 0)
+        return false;
+
+    return true;
+  }
+
+  template<size_t N>
+  constexpr
+  int
+  cmp(const limbs_t<N> &a_,
+      const limbs_t<N> &b_)
+  {
+    for(size_t i = N; i-- > 0;)
+      {
+        if(a_.v[i] > b_.v[i])
+          return 1;
+        if(a_.v[i] < b_.v[i])
+          return -1;
+      }
+
+    return 0;
+  }
+
+  template<size_t N>
+  constexpr
+  uint64_t
+  add(limbs_t<N>       &r_,
+      const limbs_t<N> &b_)
+  {
+    uint64_t c = 0;
+
+    for(size_t i = 0; i < N; i++)
+      {
+        uint64_t t = (r_.v[i] + c);
+
+        c       = (t < c);
+        r_.v[i] = (t + b_.v[i]);
+        c      += (r_.v[i] < t);
+      }
+
+    return c;
+  }
+
+  template<size_t N>
+  constexpr
+  uint64_t
+  sub(limbs_t<N>       &r_,
+      const limbs_t<N> &b_)
+  {
+    uint64_t c = 0;
+
+    for(size_t i = 0; i < N; i++)
+      {
+        uint64_t t = (r_.v[i] - b_.v[i]);
+        uint64_t b = (t > r_.v[i]);
+
+        r_.v[i] = (t - c);
+        c       = (b + (r_.v[i] > t));
+      }
+
+    return c;
+  }
+
+  template<size_t N>
+  constexpr
+  uint64_t
+  shl1(limbs_t<N> &r_)
+  {
+    uint64_t c = 0;
+
+    for(size_t i = 0; i < N; i++)
+      {
+        uint64_t t = r_.v[i];
+
+        r_.v[i] = ((t << 1) | c);
+        c       = (t >> 63);
+      }
+
+    return c;
+  }
+
+  template<size_t N>
+  constexpr
+  void
+  shr1(limbs_t<N> &r_,
+       uint64_t    hi_)
+  {
+    for(size_t i = 0; i < N; i++)
+      {
+        uint64_t next = ((i + 1) < N) ? r_.v[i + 1] : hi_;
+
+        r_.v[i] = ((r_.v[i] >> 1) | (next << 63));
+      }
+  }
+
+  constexpr
+  void
+  mul64(uint64_t  a_,
+        uint64_t  b_,
+        uint64_t &hi_,
+        uint64_t &lo_)
+  {
+    uint64_t ll  = ((a_ & 0xFFFFFFFF) * (b_ & 0xFFFFFFFF));
+    uint64_t lh  = ((a_ & 0xFFFFFFFF) * (b_ >> 32));
+    uint64_t hl  = ((a_ >> 32) * (b_ & 0xFFFFFFFF));
+    uint64_t hh  = ((a_ >> 32) * (b_ >> 32));
+    uint64_t mid = ((ll >> 32) + (lh & 0xFFFFFFFF) + (hl & 0xFFFFFFFF));
+
+    lo_ = ((ll & 0xFFFFFFFF) | (mid << 32));
+    hi_ = (hh + (lh >> 32) + (hl >> 32) + (mid >> 32));
+  }
+
+  template<size_t N, size_t M>
+  constexpr
+  limbs_t<N + M>
+  mul(const limbs_t<N> &a_,
+      const limbs_t<M> &b_)
+  {
+    limbs_t<N + M> r{};
+
+    for(size_t i = 0; i < N; i++)
+      {
+        uint64_t c = 0;
+
+        for(size_t j = 0; j < M; j++)
+          {
+            uint64_t hi = 0;
+            uint64_t lo = 0;
+
+            mul64(a_.v[i],b_.v[j],hi,lo);
+            lo += c;
+            hi += (lo < c);
+            r.v[i + j] += lo;
+            hi += (r.v[i + j] < lo);
+            c = hi;
+          }
+        r.v[i + M] = c;
+      }
+
+    return r;
+  }
+
+  /* a mod m by shift and subtract, one bit of a at a time */
+  template<size_t N, size_t M>
+  constexpr
+  limbs_t<N>
+  mod(const limbs_t<M> &a_,
+      const limbs_t<N> &m_)
+  {
+    limbs_t<N> r{};
+
+    for(size_t i = (M * 64); i-- > 0;)
+      {
+        uint64_t c = shl1(r);
+
+        r.v[0] |= ((a_.v[i / 64] >> (i % 64)) & 1);
+        if(c || (cmp(r,m_) >= 0))
+          sub(r,m_);
+      }
+
+    return r;
+  }
+
+  /* R^2 mod m for R = 2^(64 * N), by doubling 1 2 * 64 * N times */
+  template<size_t N>
+  constexpr
+  limbs_t<N>
+  mont_r2(const limbs_t<N> &m_)
+  {
+    limbs_t<N> r = from_u64<N>(1);
+
+    for(size_t i = 0; i < (2 * 64 * N); i++)
+      {
+        uint64_t c = shl1(r);
+
+        if(c || (cmp(r,m_) >= 0))
+          sub(r,m_);
+      }
+
+    return r;
+  }
+
+  /* -m^-1 mod 2^64 by Newton iteration, as mpfw's mont_init */
+  constexpr
+  uint64_t
+  mont_ninv(uint64_t m0_)
+  {
+    uint64_t inv = m0_;
+
+    if((m0_ & 1) == 0)
+      throw "Montgomery modulus must be odd";
+
+    for(int i = 0; i < 5; i++)
+      inv *= (2 - (m0_ * inv));
+
+    return (0 - inv);
+  }
+
+  /* x / 2 mod m for odd m */
+  template<size_t N>
+  constexpr
+  void
+  mod_half(limbs_t<N>       &x_,
+           const limbs_t<N> &m_)
+  {
+    uint64_t c = 0;
+
+    if(x_.v[0] & 1)
+      c = add(x_,m_);
+    shr1(x_,c);
+  }
+
+  template<size_t N>
+  constexpr
+  void
+  mod_sub(limbs_t<N>       &x_,
+          const limbs_t<N> &y_,
+          const limbs_t<N> &m_)
+  {
+    if(sub(x_,y_))
+      add(x_,m_);
+  }
+
+  /* a^-1 mod m for odd m and 0 < a < m: binary extended Euclid */
+  template<size_t N>
+  constexpr
+  limbs_t<N>
+  mod_inv(const limbs_t<N> &a_,
+          const limbs_t<N> &m_)
+  {
+    limbs_t<N> u  = a_;
+    limbs_t<N> v  = m_;
+    limbs_t<N> x1 = from_u64<N>(1);
+    limbs_t<N> x2 = from_u64<N>(0);
+
+    if(is_u64(a_,0) || (cmp(a_,m_) >= 0) || ((m_.v[0] & 1) == 0))
+      throw "no inverse";
+
+    while(!is_u64(u,1) && !is_u64(v,1))
+      {
+        while((u.v[0] & 1) == 0)
+          {
+            shr1(u,0);
+            mod_half(x1,m_);
+          }
+        while((v.v[0] & 1) == 0)
+          {
+            shr1(v,0);
+            mod_half(x2,m_);
+          }
+
+        if(cmp(u,v) >= 0)
+          {
+            sub(u,v);
+            mod_sub(x1,x2,m_);
+          }
+        else
+          {
+            sub(v,u);
+            mod_sub(x2,x1,m_);
+          }
+
+        if(is_u64(u,0) || is_u64(v,0))
+          throw "no inverse";
+      }
+
+    return (is_u64(u,1) ? x1 : x2);
+  }
+
+  template<size_t N>
+  constexpr
+  void
+  copy(uint64_t         *r_,
+       const limbs_t<N> &a_)
+  {
+    for(size_t i = 0; i < N; i++)
+      r_[i] = a_.v[i];
+  }
+
+  /* e * d' = 1 mod (m - 1) where d' = d mod (m - 1) */
+  constexpr
+  limbs_t<P_LIMBS>
+  crt_exponent(const limbs_t<N_LIMBS> &d_,
+               const limbs_t<N_LIMBS> &e_,
+               const limbs_t<P_LIMBS> &m_)
+  {
+    limbs_t<P_LIMBS> m1 = m_;
+    limbs_t<P_LIMBS> dm{};
+
+    sub(m1,from_u64<P_LIMBS>(1));
+    dm = mod(d_,m1);
+    if(!is_u64(mod(mul(e_,dm),m1),1))
+      throw "d is not the inverse of e";
+
+    return dm;
+  }
+
+  constexpr
+  tdo_keys_const_t
+  derive(const char *n_,
+         const char *d_,
+         const char *e_,
+         const char *p_,
+         const char *q_)
+  {
+    tdo_keys_const_t k{};
+    limbs_t<N_LIMBS> n = from_hex<N_LIMBS>(n_);
+    limbs_t<N_LIMBS> d = from_hex<N_LIMBS>(d_);
+    limbs_t<N_LIMBS> e = from_hex<N_LIMBS>(e_);
+    limbs_t<P_LIMBS> p = from_hex<P_LIMBS>(p_);
+    limbs_t<P_LIMBS> q = from_hex<P_LIMBS>(q_);
+    limbs_t<P_LIMBS> qinv{};
+
+    if(cmp(mul(p,q),n) != 0)
+      throw "n != p * q";
+
+    qinv = mod_inv(mod(q,p),p);
+    if(!is_u64(mod(mul(q,qinv),p),1))
+      throw "bad qinv";
+
+    copy(k.n,n);
+    copy(k.d,d);
+    copy(k.e,e);
+    copy(k.p,p);
+    copy(k.q,q);
+    copy(k.dp,crt_exponent(d,e,p));
+    copy(k.dq,crt_exponent(d,e,q));
+    copy(k.qinv,qinv);
+    copy(k.n_r2,mont_r2(n));
+    copy(k.p_r2,mont_r2(p));
+    copy(k.q_r2,mont_r2(q));
+    k.n_ninv = mont_ninv(n.v[0]);
+    k.p_ninv = mont_ninv(p.v[0]);
+    k.q_ninv = mont_ninv(q.v[0]);
+
+    return k;
+  }
+
+  constexpr tdo_keys_const_t M1_RETAIL_3DO =
+    derive("B19462B00D8D6E1EC909AB385E06FE034BFD282E9FFDC584838C15F12593DD1E3A8B5626F1B9D0ED0C384EF6C5D14512BD72DDB85B44080E0472C03D0AFC4C97",
+           "42F7CD9BCD109805BE150A60107D9C8F8BB9A5CCA78361588EEF665AF1ABE887DBC2593D0868F364A93C8CB8CC6F4BCC6A3DE57E04B17AC52F2649939C453F61",
+           "10001",
+           "E1BE29DE79315A1CD384C61DB3BACA5227C2D5A2020899283328C8E9C9B53BB1",
+           "C9619D5BBAEB0DEBCC6D144E380C987108C33FA379BB0CE1F714A7E92DF0C6C7");
+
+  constexpr tdo_keys_const_t M1_RETAIL_APP =
+    derive("BC0B199086C7F26CBC9D50F404944DB4789FCBFCF7AD8DBC2120898ABEAAF311EEA20229035608841FA41073ABBD5D37500C60B53BFB46605740381B72C9DB71",
+           "18B2207E61A51ACA7B0EF215CA102C105A9329F824130FFD38208CCFC2F0B2915B8AD1E7772334381737D232B183C869C34940BC8769C97E18D7B0E78C492991",
+           "10001",
+           "CBBA701095E52D2D96F4153328F7B85D147D273D1033AE034721F1B09A96FED5",
+           "EC4A6C856F69EA7F910C4327E4586DCFAEC8C6E7AC875A435AD6EDB7476AD02D");
+}
+
+const tdo_keys_const_t TDO_KEYS_M1_RETAIL_3DO = M1_RETAIL_3DO;
+const tdo_keys_const_t TDO_KEYS_M1_RETAIL_APP = M1_RETAIL_APP;
@@ -0,0 +1,60 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#define TDO_KEYS_CONST_N_LIMBS 8
+#define TDO_KEYS_CONST_P_LIMBS 4
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A retail key as little-endian 64-bit limbs with everything signing
+ * derives from it computed by the compiler: CRT exponents, qinv and
+ * for n, p and q the Montgomery constants R^2 mod m (R = 2^(64 *
+ * limbs)) and ninv = -m^-1 mod 2^64. See tdo_keys_const.cpp.
+ */
+typedef struct tdo_keys_const_s tdo_keys_const_t;
+struct tdo_keys_const_s
+{
+  uint64_t n[TDO_KEYS_CONST_N_LIMBS];
+  uint64_t d[TDO_KEYS_CONST_N_LIMBS];
+  uint64_t e[TDO_KEYS_CONST_N_LIMBS];
+  uint64_t p[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t q[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t dp[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t dq[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t qinv[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t n_r2[TDO_KEYS_CONST_N_LIMBS];
+  uint64_t p_r2[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t q_r2[TDO_KEYS_CONST_P_LIMBS];
+  uint64_t n_ninv;
+  uint64_t p_ninv;
+  uint64_t q_ninv;
+};
+
+extern const tdo_keys_const_t TDO_KEYS_M1_RETAIL_3DO;
+extern const tdo_keys_const_t TDO_KEYS_M1_RETAIL_APP;
+
+#ifdef __cplusplus
+}
+#endif
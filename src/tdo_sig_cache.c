@@ -0,0 +1,460 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+/*
+ * Signature cache.
+ *
+ * PKCS#1 v1.5 signatures are deterministic so a signature can be
+ * reused whenever the same key signs the same digest again. The cache
+ * is an append-only log of (key id, digest, signature) records loaded
+ * into an open addressing hash table when opened. New signatures are
+ * appended as they are made. A record torn by an interrupted write
+ * fails its check and it and anything after it are dropped.
+ *
+ * The check is MD5 over the record and, like the md5 checkpoints,
+ * only guards against accidents. Callers verify hits against the key
+ * before using them.
+ *
+ * Layout, all integers little-endian:
+ *   magic[8]
+ *   n * { key_id[16] digest[16] sig_size:u32 sig[sig_size] check[8] }
+ */
+
+#include "tdo_sig_cache.h"
+
+#include "md5.h"
+#include "tdo_keys.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define CACHE_MAGIC      "MBSIGC01"
+#define CACHE_MAGIC_SIZE 8
+#define CACHE_CHECK_SIZE 8
+#define CACHE_SIG_MAX    TDO_KEYS_MSG_MAX_SIZE
+#define CACHE_REC_HDR    (TDO_SIG_CACHE_ID_SIZE + sizeof(md5_digest_t) + 4)
+
+typedef struct cache_entry_s cache_entry_t;
+struct cache_entry_s
+{
+  uint8_t      key_id[TDO_SIG_CACHE_ID_SIZE];
+  md5_digest_t digest;
+  size_t       sig_off;
+  size_t       sig_size;
+};
+
+struct tdo_sig_cache_s
+{
+  char          *filepath;
+  FILE          *file;
+  bool           has_magic;
+  cache_entry_t *entries;
+  size_t         count;
+  size_t         entries_cap;
+  uint8_t       *sigs;
+  size_t         sigs_size;
+  size_t         sigs_cap;
+  uint32_t      *slots;
+  size_t         slots_cap;
+};
+
+static
+uint32_t
+get_u32_le(const uint8_t *p_)
+{
+  return (((uint32_t)p_[0] <<  0) |
+          ((uint32_t)p_[1] <<  8) |
+          ((uint32_t)p_[2] << 16) |
+          ((uint32_t)p_[3] << 24));
+}
+
+static
+void
+put_u32_le(uint8_t  *p_,
+           uint32_t  v_)
+{
+  for(int i = 0; i < 4; i++, v_ >>= 8)
+    p_[i] = (uint8_t)v_;
+}
+
+/* Digests and key ids are MD5 output so their leading bytes are
+   already well mixed */
+static
+size_t
+entry_hash(const uint8_t      *key_id_,
+           const md5_digest_t  digest_)
+{
+  size_t h;
+
+  h = 0;
+  for(size_t i = 0; i < sizeof(h); i++)
+    h = ((h << 8) | (digest_[i] ^ key_id_[i]));
+
+  return h;
+}
+
+static
+void
+record_check(const uint8_t *rec_,
+             size_t         size_,
+             uint8_t        check_[CACHE_CHECK_SIZE])
+{
+  md5_ctx_t ctx;
+  md5_digest_t digest;
+
+  md5_init(&ctx);
+  md5_update(&ctx,rec_,size_);
+  md5_finalize(&ctx,digest);
+
+  memcpy(check_,digest,CACHE_CHECK_SIZE);
+}
+
+static
+cache_entry_t*
+index_find(const tdo_sig_cache_t *cache_,
+           const uint8_t         *key_id_,
+           const md5_digest_t     digest_)
+{
+  size_t mask;
+
+  if(cache_->slots_cap == 0)
+    return NULL;
+
+  mask = (cache_->slots_cap - 1);
+  for(size_t i = (entry_hash(key_id_,digest_) & mask); ; i = ((i + 1) & mask))
+    {
+      cache_entry_t *e;
+
+      if(cache_->slots[i] == 0)
+        return NULL;
+
+      e = &cache_->entries[cache_->slots[i] - 1];
+      if(!memcmp(e->digest,digest_,sizeof(md5_digest_t)) &&
+         !memcmp(e->key_id,key_id_,TDO_SIG_CACHE_ID_SIZE))
+        return e;
+    }
+}
+
+static
+void
+index_insert(tdo_sig_cache_t *cache_,
+             size_t           idx_)
+{
+  size_t i;
+  size_t mask;
+  const cache_entry_t *e;
+
+  e    = &cache_->entries[idx_];
+  mask = (cache_->slots_cap - 1);
+  for(i = (entry_hash(e->key_id,e->digest) & mask);
+      cache_->slots[i] != 0;
+      i = ((i + 1) & mask))
+    ;
+
+  cache_->slots[i] = (idx_ + 1);
+}
+
+/* Keep the table at most half full */
+static
+int
+index_reserve(tdo_sig_cache_t *cache_,
+              size_t           count_)
+{
+  size_t cap;
+  uint32_t *slots;
+
+  if((count_ * 2) <= cache_->slots_cap)
+    return 0;
+
+  for(cap = 64; cap < (count_ * 2); cap *= 2)
+    ;
+
+  slots = calloc(cap,sizeof(uint32_t));
+  if(slots == NULL)
+    return -1;
+
+  free(cache_->slots);
+  cache_->slots     = slots;
+  cache_->slots_cap = cap;
+  for(size_t i = 0; i < cache_->count; i++)
+    index_insert(cache_,i);
+
+  return 0;
+}
+
+static
+int
+entry_add(tdo_sig_cache_t    *cache_,
+          const uint8_t      *key_id_,
+          const md5_digest_t  digest_,
+          const uint8_t      *sig_,
+          size_t              sig_size_)
+{
+  cache_entry_t *e;
+
+  if(cache_->count == cache_->entries_cap)
+    {
+      size_t cap;
+
+      cap = (cache_->entries_cap ? (cache_->entries_cap * 2) : 64);
+      e   = realloc(cache_->entries,(cap * sizeof(cache_entry_t)));
+      if(e == NULL)
+        return -1;
+      cache_->entries     = e;
+      cache_->entries_cap = cap;
+    }
+
+  if((cache_->sigs_size + sig_size_) > cache_->sigs_cap)
+    {
+      size_t cap;
+      uint8_t *sigs;
+
+      cap = (cache_->sigs_cap ? cache_->sigs_cap : 4096);
+      while(cap < (cache_->sigs_size + sig_size_))
+        cap *= 2;
+      sigs = realloc(cache_->sigs,cap);
+      if(sigs == NULL)
+        return -1;
+      cache_->sigs     = sigs;
+      cache_->sigs_cap = cap;
+    }
+
+  if(index_reserve(cache_,(cache_->count + 1)) < 0)
+    return -1;
+
+  e = &cache_->entries[cache_->count];
+  memcpy(e->key_id,key_id_,TDO_SIG_CACHE_ID_SIZE);
+  memcpy(e->digest,digest_,sizeof(md5_digest_t));
+  e->sig_off  = cache_->sigs_size;
+  e->sig_size = sig_size_;
+  memcpy(&cache_->sigs[cache_->sigs_size],sig_,sig_size_);
+  cache_->sigs_size += sig_size_;
+
+  index_insert(cache_,cache_->count);
+  cache_->count++;
+
+  return 0;
+}
+
+/*
+ * Reads records until the end of the file or the first one which is
+ * short or fails its check. Returns the offset just past the last
+ * good record or -1 if the file isn't a cache.
+ */
+static
+long
+cache_load(tdo_sig_cache_t *cache_,
+           FILE            *file_)
+{
+  long end;
+  size_t sig_size;
+  uint8_t magic[CACHE_MAGIC_SIZE];
+  uint8_t check[CACHE_CHECK_SIZE];
+  uint8_t rec[CACHE_REC_HDR + CACHE_SIG_MAX + CACHE_CHECK_SIZE];
+
+  if((fread(magic,1,sizeof(magic),file_) != sizeof(magic)) ||
+     memcmp(magic,CACHE_MAGIC,CACHE_MAGIC_SIZE))
+    return -1;
+
+  end = CACHE_MAGIC_SIZE;
+  for(;;)
+    {
+      if(fread(rec,1,CACHE_REC_HDR,file_) != CACHE_REC_HDR)
+        break;
+      sig_size = get_u32_le(&rec[CACHE_REC_HDR - 4]);
+      if(sig_size > CACHE_SIG_MAX)
+        break;
+      if(fread(&rec[CACHE_REC_HDR],1,(sig_size + CACHE_CHECK_SIZE),file_) !=
+         (sig_size + CACHE_CHECK_SIZE))
+        break;
+
+      record_check(rec,(CACHE_REC_HDR + sig_size),check);
+      if(memcmp(check,&rec[CACHE_REC_HDR + sig_size],CACHE_CHECK_SIZE))
+        break;
+
+      if(entry_add(cache_,
+                   &rec[0],
+                   &rec[TDO_SIG_CACHE_ID_SIZE],
+                   &rec[CACHE_REC_HDR],
+                   sig_size) < 0)
+        break;
+
+      end += (CACHE_REC_HDR + sig_size + CACHE_CHECK_SIZE);
+    }
+
+  return end;
+}
+
+/*
+ * Opens or creates the cache at filepath_. Returns NULL, after a
+ * warning, if it can't be used; signing then just goes uncached.
+ */
+tdo_sig_cache_t*
+tdo_sig_cache_open(const char *filepath_)
+{
+  long end;
+  long size;
+  FILE *file;
+  tdo_sig_cache_t *cache;
+
+  cache = calloc(1,sizeof(tdo_sig_cache_t));
+  if(cache == NULL)
+    return NULL;
+  cache->filepath = strdup(filepath_);
+  if(cache->filepath == NULL)
+    goto error;
+
+  file = fopen(filepath_,"rb");
+  if(file == NULL)
+    return cache;
+
+  fseek(file,0,SEEK_END);
+  size = ftell(file);
+  fseek(file,0,SEEK_SET);
+
+  end = ((size > 0) ? cache_load(cache,file) : 0);
+  fclose(file);
+
+  if(end < 0)
+    {
+      fprintf(stderr,"WARNING: '%s' is not a signature cache. Ignoring.\n",filepath_);
+      goto error;
+    }
+
+  if(end != size)
+    {
+      fprintf(stderr,"WARNING: dropping damaged tail of signature cache '%s'\n",filepath_);
+      if(truncate(filepath_,end) != 0)
+        {
+          fprintf(stderr,
+                  "WARNING: unable to truncate signature cache '%s' - %s\n",
+                  filepath_,
+                  strerror(errno));
+          goto error;
+        }
+    }
+
+  cache->has_magic = (end > 0);
+
+  return cache;
+
+ error:
+  tdo_sig_cache_close(cache);
+  return NULL;
+}
+
+/* Flushes any new records and frees the cache */
+int
+tdo_sig_cache_close(tdo_sig_cache_t *cache_)
+{
+  int rv;
+
+  if(cache_ == NULL)
+    return 0;
+
+  rv = 0;
+  if((cache_->file != NULL) && (fclose(cache_->file) != 0))
+    {
+      fprintf(stderr,
+              "WARNING: unable to write signature cache '%s' - %s\n",
+              cache_->filepath,
+              strerror(errno));
+      rv = -1;
+    }
+
+  free(cache_->slots);
+  free(cache_->sigs);
+  free(cache_->entries);
+  free(cache_->filepath);
+  free(cache_);
+
+  return rv;
+}
+
+/* The cached signature of sig_size_ octets or NULL */
+const
+uint8_t*
+tdo_sig_cache_get(const tdo_sig_cache_t *cache_,
+                  const uint8_t          key_id_[TDO_SIG_CACHE_ID_SIZE],
+                  const md5_digest_t     digest_,
+                  size_t                 sig_size_)
+{
+  const cache_entry_t *e;
+
+  e = index_find(cache_,key_id_,digest_);
+  if((e == NULL) || (e->sig_size != sig_size_))
+    return NULL;
+
+  return &cache_->sigs[e->sig_off];
+}
+
+/*
+ * Adds a signature to the table and appends it to the log, creating
+ * the file on first use. Signatures already present are skipped.
+ */
+int
+tdo_sig_cache_put(tdo_sig_cache_t    *cache_,
+                  const uint8_t       key_id_[TDO_SIG_CACHE_ID_SIZE],
+                  const md5_digest_t  digest_,
+                  const uint8_t      *sig_,
+                  size_t              sig_size_)
+{
+  size_t size;
+  uint8_t rec[CACHE_REC_HDR + CACHE_SIG_MAX + CACHE_CHECK_SIZE];
+
+  if((sig_size_ > CACHE_SIG_MAX) || (index_find(cache_,key_id_,digest_) != NULL))
+    return 0;
+
+  if(cache_->file == NULL)
+    {
+      cache_->file = fopen(cache_->filepath,"ab");
+      if(cache_->file == NULL)
+        {
+          fprintf(stderr,
+                  "WARNING: unable to open signature cache '%s' - %s\n",
+                  cache_->filepath,
+                  strerror(errno));
+          return -1;
+        }
+    }
+
+  if(!cache_->has_magic)
+    {
+      if(fwrite(CACHE_MAGIC,1,CACHE_MAGIC_SIZE,cache_->file) != CACHE_MAGIC_SIZE)
+        return -1;
+      cache_->has_magic = true;
+    }
+
+  memcpy(&rec[0],key_id_,TDO_SIG_CACHE_ID_SIZE);
+  memcpy(&rec[TDO_SIG_CACHE_ID_SIZE],digest_,sizeof(md5_digest_t));
+  put_u32_le(&rec[CACHE_REC_HDR - 4],sig_size_);
+  memcpy(&rec[CACHE_REC_HDR],sig_,sig_size_);
+  size = (CACHE_REC_HDR + sig_size_);
+  record_check(rec,size,&rec[size]);
+  size += CACHE_CHECK_SIZE;
+
+  if(fwrite(rec,1,size,cache_->file) != size)
+    return -1;
+
+  return entry_add(cache_,key_id_,digest_,sig_,sig_size_);
+}
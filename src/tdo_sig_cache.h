@@ -0,0 +1,41 @@
+/*
+  ISC License
+
+  Copyright (c) 2020, Antonio SJ Musumeci <trapexit@spawn.link>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#pragma once
+
+#include "md5.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define TDO_SIG_CACHE_ID_SIZE 16
+
+typedef struct tdo_sig_cache_s tdo_sig_cache_t;
+
+tdo_sig_cache_t *tdo_sig_cache_open(const char *filepath);
+int              tdo_sig_cache_close(tdo_sig_cache_t *cache);
+
+const uint8_t *tdo_sig_cache_get(const tdo_sig_cache_t *cache,
+                                 const uint8_t          key_id[TDO_SIG_CACHE_ID_SIZE],
+                                 const md5_digest_t     digest,
+                                 size_t                 sig_size);
+int            tdo_sig_cache_put(tdo_sig_cache_t *cache,
+                                 const uint8_t    key_id[TDO_SIG_CACHE_ID_SIZE],
+                                 const md5_digest_t digest,
+                                 const uint8_t   *sig,
+                                 size_t           sig_size);